@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "vsfs.h"
+#include "library.h"
+
+extern void *disk;
+
+/*****************************************************************
+ * Per-block CRC32C checksums.                                   *
+ * The table (one uint32_t per disk block) lives in the last     *
+ * csumBlocks blocks of the disk, which are marked used in the   *
+ * data bit map. The checksum of a block is recomputed as soon   *
+ * as vsfs writes to it, so the table is always current. Sums    *
+ * are verified when file data is read and by fsck.              *
+ ****************************************************************/
+static int8_t mounted = FALSE;				// TRUE <=> sums are kept up to date
+
+static uint32_t *getSums () {
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	return (uint32_t *)(disk + sb->csumStart * sb->blockSize);
+}
+
+static uint32_t sumOf (int64_t blockNb) {
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	return crc32c (disk + (int64_t)blockNb * sb->blockSize, sb->blockSize);
+}
+
+/*************************************************
+ * Place the checksum table at the end of a new  *
+ * disk and reserve its blocks in the data bit   *
+ * map. Called by vsfs_initDisk.                 *
+ ************************************************/
+void csumFormat () {
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	int64_t firstData = 1 + sb->iNodeBMSize + sb->dataBMSize + sb->iNodeTabSize;
+
+	sb->csumBlocks = (sb->blockCnt * (int64_t)sizeof (uint32_t) + sb->blockSize - 1) / sb->blockSize;
+	sb->csumStart = sb->blockCnt - sb->csumBlocks;
+	assert (sb->csumStart > firstData);
+
+	int8_t *dataBM = (int8_t *) (disk + sb->blockSize + sb->blockSize*sb->iNodeBMSize);
+	for (int64_t b = sb->csumStart - firstData; b < sb->blockCnt - firstData; b++) {
+		dataBM[b/8] |= (1 << (b%8));
+	}
+	sb->freeDataCnt -= sb->csumBlocks;
+}//csumFormat
+
+/*************************************************
+ * Stop keeping checksums (at unmount)           *
+ ************************************************/
+void csumRelease () {
+	mounted = FALSE;
+}//csumRelease
+
+/*************************************************
+ * Compute the checksum of every block (at       *
+ * mount, once the file system is in place).     *
+ ************************************************/
+void csumBuild () {
+	assert (disk != NULL);
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+
+	crc32cInit ();
+	uint32_t *sums = getSums ();
+	for (int64_t b=0; b<sb->csumStart; b++) {
+		sums[b] = sumOf (b);
+	}
+	mounted = TRUE;
+}//csumBuild
+
+/*************************************************
+ * Recompute the checksum of the blocks covering *
+ * len bytes from addr, which were just written  *
+ ************************************************/
+void csumUpdate (const void *addr, int64_t len) {
+	devAccess (addr, len, DEV_WRITE);
+	if (!mounted) {
+		return;			// not mounted yet: csumBuild sums everything
+	}
+	uint32_t *sums = getSums ();
+	int64_t first = geo->blockOf (addr);
+	int64_t last = geo->blockOf ((const char *)addr + len - 1);
+	for (int64_t b=first; b<=last; b++) {
+		sums[b] = sumOf (b);
+	}
+}//csumUpdate
+
+/*************************************************
+ * Verify the blocks covering len bytes from     *
+ * addr before they are read.                    *
+ * return 0 if they are intact                   *
+ *        -5 checksum mismatch, or a read of     *
+ *           them failed (see devFault)          *
+ ************************************************/
+int32_t csumCheck (const void *addr, int32_t len) {
+	if (!mounted) {
+		return 0;
+	}
+	uint32_t *sums = getSums ();
+	int64_t first = geo->blockOf (addr);
+	int64_t last = geo->blockOf ((const char *)addr + len - 1);
+	for (int64_t b=first; b<=last; b++) {
+		if (devFault (b)) {
+			return -5;			// printed by the read that failed
+		}
+		if (sums[b] != sumOf (b)) {
+			printf ("checksum error in block %lld\n", (long long)b);
+			return -5;
+		}
+	}
+	return 0;
+}//csumCheck
+
+typedef struct VerifyJob {
+	int64_t first;				// first block to verify
+	int64_t last;					// last block + 1
+	int64_t badCnt;				// blocks found corrupted
+	int64_t firstBad;			// lowest corrupted block, -1 if none
+} VerifyJob_t;
+
+static void *verifyRange (void *arg) {
+	VerifyJob_t *job = (VerifyJob_t *)arg;
+	uint32_t *sums = getSums ();
+	for (int64_t b=job->first; b<job->last; b++) {
+		if (sums[b] != sumOf (b)) {
+			if (job->badCnt++ == 0) {
+				job->firstBad = b;
+			}
+		}
+	}
+	return NULL;
+}
+
+/*************************************************
+ * Verify every block with threadCnt threads.    *
+ * return number of corrupted blocks, lowest one *
+ * in *firstBad (-1 if none)                     *
+ ************************************************/
+int64_t csumVerifyAll (int32_t threadCnt, int64_t *firstBad) {
+	assert (mounted);
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	if (threadCnt < 1) {
+		threadCnt = 1;
+	}
+	if (threadCnt > CSUM_MAXTHREADS) {
+		threadCnt = CSUM_MAXTHREADS;
+	}
+	// Blocks being cleared in the background don't match their sums yet
+	reclaimDrain ();
+
+	pthread_t tid[CSUM_MAXTHREADS];
+	VerifyJob_t job[CSUM_MAXTHREADS];
+	int64_t per = (sb->csumStart + threadCnt - 1) / threadCnt;
+	for (int32_t t=0; t<threadCnt; t++) {
+		job[t].first = t * per;
+		job[t].last = (t + 1) * per < sb->csumStart ? (t + 1) * per : sb->csumStart;
+		job[t].badCnt = 0;
+		job[t].firstBad = -1;
+		if (t > 0) {
+			int rc = pthread_create (&tid[t], NULL, verifyRange, &job[t]);
+			assert (rc == 0);
+		}
+	}
+	verifyRange (&job[0]);
+
+	int64_t bad = job[0].badCnt;
+	*firstBad = job[0].firstBad;
+	for (int32_t t=1; t<threadCnt; t++) {
+		pthread_join (tid[t], NULL);
+		bad += job[t].badCnt;
+		if (*firstBad == -1) {
+			*firstBad = job[t].firstBad;
+		}
+	}
+	return bad;
+}//csumVerifyAll
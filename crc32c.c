@@ -0,0 +1,143 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "vsfs.h"
+#include "library.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_X86
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM
+#endif
+
+/*****************************************************************
+ * CRC32C (Castagnoli, reflected polynomial 0x82f63b78).         *
+ * Uses the SSE4.2 crc32 instruction when the CPU has it (or the *
+ * ARMv8 CRC extension when compiled for it), slice-by-8 tables  *
+ * otherwise. The implementation is chosen on first use.         *
+ ****************************************************************/
+#define CRC32C_POLY		0x82f63b78
+
+static uint32_t table[8][256];
+static uint32_t (*crcUpdate) (uint32_t, const uint8_t *, size_t) = NULL;
+
+static void buildTables () {
+	for (uint32_t i=0; i<256; i++) {
+		uint32_t c = i;
+		for (int k=0; k<8; k++) {
+			c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+		}
+		table[0][i] = c;
+	}
+	for (uint32_t i=0; i<256; i++) {
+		for (int t=1; t<8; t++) {
+			table[t][i] = (table[t-1][i] >> 8) ^ table[0][table[t-1][i] & 0xff];
+		}
+	}
+}
+
+// Slice-by-8: 8 table lookups per 8 input bytes
+static uint32_t crcSoft (uint32_t crc, const uint8_t *p, size_t len) {
+	while (len >= 8) {
+		uint32_t lo, hi;
+		memcpy (&lo, p, 4);
+		memcpy (&hi, p + 4, 4);
+		lo ^= crc;
+		crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff]
+			^ table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24]
+			^ table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff]
+			^ table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+		p += 8;
+		len -= 8;
+	}
+	while (len--) {
+		crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+	}
+	return crc;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2")))
+static uint32_t crcHard (uint32_t crc, const uint8_t *p, size_t len) {
+#ifdef __x86_64__
+	uint64_t c = crc;
+	while (len >= 8) {
+		uint64_t v;
+		memcpy (&v, p, 8);
+		c = _mm_crc32_u64 (c, v);
+		p += 8;
+		len -= 8;
+	}
+	crc = (uint32_t)c;
+#endif
+	while (len >= 4) {
+		uint32_t v;
+		memcpy (&v, p, 4);
+		crc = _mm_crc32_u32 (crc, v);
+		p += 4;
+		len -= 4;
+	}
+	while (len--) {
+		crc = _mm_crc32_u8 (crc, *p++);
+	}
+	return crc;
+}
+#endif
+
+#ifdef CRC32C_ARM
+static uint32_t crcHard (uint32_t crc, const uint8_t *p, size_t len) {
+	while (len >= 8) {
+		uint64_t v;
+		memcpy (&v, p, 8);
+		crc = __crc32cd (crc, v);
+		p += 8;
+		len -= 8;
+	}
+	while (len--) {
+		crc = __crc32cb (crc, *p++);
+	}
+	return crc;
+}
+#endif
+
+/************************************************
+ * Pick the implementation. Must run once before *
+ * concurrent use (done by csumBuild).           *
+ ***********************************************/
+void crc32cInit () {
+	if (crcUpdate != NULL) {
+		return;
+	}
+	buildTables ();
+	crcUpdate = crcSoft;
+#if defined(CRC32C_X86)
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("sse4.2")) {
+		crcUpdate = crcHard;
+	}
+#elif defined(CRC32C_ARM)
+	crcUpdate = crcHard;
+#endif
+}//crc32cInit
+
+/******************************
+ * CRC32C of len bytes of buf *
+ *****************************/
+uint32_t crc32c (const void *buf, size_t len) {
+	if (crcUpdate == NULL) {
+		crc32cInit ();
+	}
+	return ~crcUpdate (~0u, (const uint8_t *)buf, len);
+}//crc32c
+
+/*******************************************
+ * TRUE when the hardware instruction is   *
+ * used (for reports)                      *
+ ******************************************/
+bool crc32cHardware () {
+	crc32cInit ();
+	return crcUpdate != crcSoft;
+}//crc32cHardware
@@ -0,0 +1,269 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "vsfs.h"
+#include "library.h"
+
+extern void *disk;
+
+/*************************************************************
+ * Block-level deduplication of file data.                   *
+ * Every data block has a reference count (number of iNode   *
+ * pointers to it). Blocks of data files are also entered in *
+ * a hash index (open addressing, linear probing) so that a  *
+ * block about to be written can be matched with an existing *
+ * identical one and shared instead. Shared blocks are never *
+ * written in place: writeData gives the file a new block.   *
+ * Counts and index live in memory and are rebuilt at mount. *
+ ************************************************************/
+typedef struct HashSlot {
+	uint64_t hash;				// hash of the block content
+	int64_t block;				// data block number, -1 <=> empty slot
+} HashSlot_t;
+
+static int32_t *refCnt = NULL;			// references to each data block
+static uint64_t *blockHash = NULL;	// hash of each indexed block
+static int8_t *indexed = NULL;			// TRUE <=> block is in the hash index
+static HashSlot_t *slots = NULL;
+static int64_t slotMask = 0;				// slot count - 1 (power of 2)
+static int64_t dataCnt = 0;
+
+static int32_t getBlockSize () {
+	return ((SuperBlock_t *)disk)->blockSize;
+}
+
+static void indexInsert (int64_t block) {
+	uint64_t h = geo->blockHash (getDataBlock (block));
+	int64_t i = (int64_t)(h & slotMask);
+	while (slots[i].block != -1) {
+		i = (i + 1) & slotMask;
+	}
+	slots[i].hash = h;
+	slots[i].block = block;
+	blockHash[block] = h;
+	indexed[block] = TRUE;
+}
+
+// Remove block from the index. Later slots of the probe run are
+// shifted back so that lookups never need tombstones.
+static void indexRemove (int64_t block) {
+	int64_t i = (int64_t)(blockHash[block] & slotMask);
+	while (slots[i].block != block) {
+		assert (slots[i].block != -1);
+		i = (i + 1) & slotMask;
+	}
+	int64_t hole = i;
+	for (int64_t j = (hole + 1) & slotMask; slots[j].block != -1; j = (j + 1) & slotMask) {
+		int64_t home = (int64_t)(slots[j].hash & slotMask);
+		// Move j into the hole unless its home lies in (hole, j]
+		if (((j - home) & slotMask) >= ((j - hole) & slotMask)) {
+			slots[hole] = slots[j];
+			hole = j;
+		}
+	}
+	slots[hole].block = -1;
+	indexed[block] = FALSE;
+}
+
+// First used iNode from n on, iNodeCnt if none.
+// Empty 64-bit words of the bit map are skipped.
+static int64_t nextInode (const int8_t *iNodeBM, int64_t n, int64_t iNodeCnt) {
+	while (n < iNodeCnt) {
+		if ((n % 64) == 0 && n + 64 <= iNodeCnt) {
+			uint64_t w;
+			memcpy (&w, iNodeBM + n/8, 8);
+			if (w == 0) {
+				n += 64;
+				continue;
+			}
+		}
+		if (iNodeBM[n/8] & (1 << (n%8))) {
+			return n;
+		}
+		n++;
+	}
+	return iNodeCnt;
+}
+
+/**********************************************
+ * Release the reference counts and the index *
+ *********************************************/
+void dedupRelease () {
+	free (refCnt);
+	free (blockHash);
+	free (indexed);
+	free (slots);
+	refCnt = NULL;
+	blockHash = NULL;
+	indexed = NULL;
+	slots = NULL;
+	dataCnt = 0;
+}//dedupRelease
+
+/***************************************************
+ * Rebuild reference counts from the iNode table   *
+ * and index the blocks of every data file.        *
+ **************************************************/
+void dedupBuild () {
+	assert (disk != NULL);
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+
+	dedupRelease ();
+	int64_t total, freeBlocks, extents, largest;
+	extentStats (&total, &freeBlocks, &extents, &largest);
+	dataCnt = total;
+
+	int64_t slotCnt = 2;
+	while (slotCnt < 2 * dataCnt) {
+		slotCnt *= 2;
+	}
+	slotMask = slotCnt - 1;
+
+	refCnt = calloc (dataCnt, sizeof (int32_t));
+	blockHash = calloc (dataCnt, sizeof (uint64_t));
+	indexed = calloc (dataCnt, sizeof (int8_t));
+	slots = malloc (slotCnt * sizeof (HashSlot_t));
+	assert (refCnt != NULL && blockHash != NULL && indexed != NULL && slots != NULL);
+	for (int64_t i=0; i<slotCnt; i++) {
+		slots[i].block = -1;
+	}
+
+	int8_t *iNodeBM = (int8_t *) (disk + sb->blockSize);
+	int64_t iNodeCnt = sb->iNodeTabSize * sb->blockSize / sb->iNodeSize;
+	for (int64_t n = nextInode (iNodeBM, 0, iNodeCnt); n < iNodeCnt; n = nextInode (iNodeBM, n + 1, iNodeCnt)) {
+		Inode_t *node = getInode (n);
+		for (int64_t i=0; i<parameters.directCnt; i++) {
+			int64_t b = node->ptr[i];
+			if (b == -1) {
+				continue;
+			}
+			if (refCnt[b]++ == 0 && node->type == FT_FIL) {
+				indexInsert (b);
+			}
+		}
+	}
+}//dedupBuild
+
+/*****************************************************
+ * Look for an indexed block identical to data (one  *
+ * block long). On a match take a reference to it.   *
+ * return block number, -1 if none                   *
+ ****************************************************/
+int64_t dedupFind (const char *data) {
+	int32_t blockSize = getBlockSize ();
+	uint64_t h = geo->blockHash (data);
+	for (int64_t i = (int64_t)(h & slotMask); slots[i].block != -1; i = (i + 1) & slotMask) {
+		if (slots[i].hash == h
+		&& memcmp (getDataBlock (slots[i].block), data, blockSize) == 0) {
+			refCnt[slots[i].block]++;
+			return slots[i].block;
+		}
+	}
+	return -1;
+}//dedupFind
+
+/*****************************************************
+ * First reference to a freshly written data block.  *
+ * Blocks of data files are indexed for sharing,     *
+ * directory blocks (updated in place) are not.      *
+ ****************************************************/
+void dedupHold (int64_t block, bool shareable) {
+	assert (block >= 0 && block < dataCnt);
+	assert (refCnt[block] == 0);
+	refCnt[block] = 1;
+	if (shareable) {
+		indexInsert (block);
+	}
+}//dedupHold
+
+/*****************************************************
+ * Number of references to a data block              *
+ ****************************************************/
+int32_t dedupRefCnt (int64_t block) {
+	assert (block >= 0 && block < dataCnt);
+	return refCnt[block];
+}//dedupRefCnt
+
+/*****************************************************
+ * Take a block out of the index before its single   *
+ * owner rewrites it in place. dedupHold it again    *
+ * afterwards.                                       *
+ ****************************************************/
+void dedupUnindex (int64_t block) {
+	assert (refCnt[block] == 1);
+	if (indexed[block]) {
+		indexRemove (block);
+	}
+	refCnt[block] = 0;
+}//dedupUnindex
+
+/*****************************************************
+ * Drop a reference to a data block.                 *
+ * return references left. At 0 the block is out of  *
+ * the index and the caller frees it.                *
+ ****************************************************/
+int32_t dedupUnref (int64_t block) {
+	assert (block >= 0 && block < dataCnt);
+	assert (refCnt[block] > 0);
+	if (--refCnt[block] == 0 && indexed[block]) {
+		indexRemove (block);
+	}
+	return refCnt[block];
+}//dedupUnref
+
+/*****************************************************
+ * Offline pass: point every block of every data     *
+ * file at the first identical indexed block and     *
+ * free the duplicates.                              *
+ * return number of data blocks freed                *
+ ****************************************************/
+int64_t dedupScan () {
+	assert (disk != NULL);
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	int64_t freed = 0;
+
+	int8_t *iNodeBM = (int8_t *) (disk + sb->blockSize);
+	int64_t iNodeCnt = sb->iNodeTabSize * sb->blockSize / sb->iNodeSize;
+	for (int64_t n = nextInode (iNodeBM, 0, iNodeCnt); n < iNodeCnt; n = nextInode (iNodeBM, n + 1, iNodeCnt)) {
+		if (getInode (n)->type != FT_FIL) {
+			continue;
+		}
+		Inode_t *node = getInode (n);
+		for (int64_t i=0; i<parameters.directCnt; i++) {
+			int64_t b = node->ptr[i];
+			if (b == -1) {
+				continue;
+			}
+			int64_t same = dedupFind (getDataBlock (b));
+			assert (same != -1);				// b itself is indexed
+			node->ptr[i] = same;
+			csumUpdate (node, sizeof (Inode_t));
+			if (dedupUnref (b) == 0) {
+				reclaimBlock (b);
+				freed++;
+			}
+		}
+	}
+	return freed;
+}//dedupScan
+
+/*****************************************************
+ * Report data file block usage:                     *
+ * references (blocks seen by files), physical       *
+ * blocks holding them and shared physical blocks.   *
+ ****************************************************/
+void dedupStats (int64_t *refs, int64_t *physical, int64_t *shared) {
+	*refs = *physical = *shared = 0;
+	for (int64_t b=0; b<dataCnt; b++) {
+		if (indexed[b]) {
+			*refs += refCnt[b];
+			(*physical)++;
+			if (refCnt[b] > 1) {
+				(*shared)++;
+			}
+		}
+	}
+}//dedupStats
@@ -0,0 +1,336 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "vsfs.h"
+#include "library.h"
+
+extern void *disk;
+
+/*****************************************************************
+ * Simulated storage device.                                     *
+ * The disk is a RAM buffer, so by default I/O costs nothing.    *
+ * With -dev every access to the disk is charged as one device   *
+ * I/O: reads through getDataBlock/getInode (the Makefile wraps  *
+ * them, see __wrap_ below), the directory scans of geometry     *
+ * (lookup, and pathLookup built on it) and the iNode bit map    *
+ * scan; writes through csumUpdate, which sees every block vsfs  *
+ * modifies; discards by the reclaim thread.                     *
+ * Not charged: format and mount, and the reads made inside      *
+ * library.c (getInodeNbFromPath, getInodeNbFromParent,          *
+ * getFileCnt, isDirectory, ...) where calls to getDataBlock and *
+ * getInode are not wrapped; vsfs resolves paths with pathLookup *
+ * instead, so no operation depends on them.                     *
+ * There is no cache: every access goes to the device, which is  *
+ * the baseline a cache or batching design is measured against.  *
+ * An I/O of len bytes on block b takes                          *
+ *   lat + len / bw + seek penalty (access not sequential)       *
+ * on the first of qd channels to be free. vsfs waits for reads  *
+ * only (its clock moves to their completion). Writes and        *
+ * discards are posted: they keep a channel busy, so later reads *
+ * queue behind them, but vsfs goes on at once. Times are        *
+ * simulated unless wait=1, which makes the caller sleep until   *
+ * the read completes so that wall-clock benchmarks and trace    *
+ * replays see them.                                             *
+ * Reads fail at random one time in fault. devIO returns -5 for  *
+ * a failed read, so a directory scan or the iNode bit map scan  *
+ * fails at once. getDataBlock and getInode return a pointer and *
+ * can't fail: the block is flagged instead, and the caller's    *
+ * checksum check of what it read (csumCheck, run before any     *
+ * iNode or block is trusted) reports it as an I/O error (-5).   *
+ ****************************************************************/
+#define DEV_MAXQD			64
+#define DEV_SLACK			1000000			// ns past a deadline still taken as oversleeping
+
+typedef struct DevModel {
+	const char *name;
+	int64_t lat;				// ns per I/O
+	int64_t bw;					// bytes per second, 0 <=> unlimited
+	int32_t qd;					// I/Os in flight
+	int64_t seek;				// ns for a full-stroke jump, half of it for any non-sequential access
+	int64_t fault;			// one read in fault fails, 0 <=> never
+	int32_t wait;				// TRUE <=> really wait for I/O completion
+} DevModel_t;
+
+static const DevModel_t profiles[] = {
+	{"ram", 0, 0, DEV_MAXQD, 0, 0, FALSE},
+	{"ssd", 20000, 2000000000LL, 32, 0, 0, FALSE},
+	{"hdd", 50000, 150000000LL, 1, 8000000, 0, FALSE},
+};
+#define PROFILECNT	(int32_t)(sizeof (profiles) / sizeof (profiles[0]))
+
+bool devActive = FALSE;
+static DevModel_t model;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int64_t chanFree[DEV_MAXQD];		// simulated time each channel is free again
+static int64_t now = 0;								// simulated time seen by vsfs (ns)
+static int64_t prevFirst = -1;				// blocks of the previous I/O
+static int64_t prevLast = -1;
+static uint64_t rng = 0x2545f4914f6cdd1dULL;
+static int8_t *faultMap = NULL;				// per block: TRUE <=> failed read not reported yet
+
+static int64_t ioCnt[3];							// per kind (DEV_READ, DEV_WRITE, DEV_TRIM)
+static int64_t byteCnt[3];
+static int64_t seqCnt = 0;						// I/Os in or right after the previous one
+static int64_t faults = 0;
+static int64_t busyNs = 0;						// sum of I/O service times
+static int64_t queueNs = 0;						// time spent waiting for a free channel
+static int64_t startNs = 0;						// simulated time when the device was set up
+static int64_t wakeAt = 0;						// wall clock deadline of the last read waited for
+
+void *__real_getDataBlock (int64_t);
+Inode_t *__real_getInode (int64_t);
+
+// Flag the blocks covering len bytes from addr: a read of them failed
+static void faultMark (const void *addr, int64_t len) {
+	int64_t first = geo->blockOf (addr);
+	int64_t last = geo->blockOf ((const char *)addr + len - 1);
+	pthread_mutex_lock (&lock);
+	for (int64_t b=first; b<=last; b++) {
+		faultMap[b] = TRUE;
+	}
+	pthread_mutex_unlock (&lock);
+}
+
+// Reads reach the disk through these once the Makefile links with
+// --wrap=getDataBlock and --wrap=getInode
+void *__wrap_getDataBlock (int64_t n) {
+	void *p = __real_getDataBlock (n);
+	int64_t len = ((SuperBlock_t *)disk)->blockSize;
+	if (devAccess (p, len, DEV_READ) != 0) {
+		faultMark (p, len);
+	}
+	return p;
+}
+
+Inode_t *__wrap_getInode (int64_t n) {
+	Inode_t *p = __real_getInode (n);
+	if (devAccess (p, sizeof (Inode_t), DEV_READ) != 0) {
+		faultMark (p, sizeof (Inode_t));
+	}
+	return p;
+}
+
+static int64_t wallNs () {
+	struct timespec t;
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return (int64_t)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static uint64_t nextRandom () {
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return rng;
+}
+
+// Set key=value of the model. return 0, -1 if unknown
+static int32_t setKey (const char *key, int64_t val) {
+	if (strcmp (key, "lat") == 0) {
+		model.lat = val;
+	} else if (strcmp (key, "bw") == 0) {
+		model.bw = val;
+	} else if (strcmp (key, "qd") == 0) {
+		model.qd = (int32_t)val;
+	} else if (strcmp (key, "seek") == 0) {
+		model.seek = val;
+	} else if (strcmp (key, "fault") == 0) {
+		model.fault = val;
+	} else if (strcmp (key, "wait") == 0) {
+		model.wait = (int32_t)val;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+/**********************************************
+ * Put the device model spec in front of the  *
+ * disk: a profile (ram, ssd, hdd) and/or     *
+ * key=value overrides separated by commas.   *
+ * Keys: lat (ns), bw (bytes/s), qd,          *
+ * seek (ns), fault (1 read in n fails) and   *
+ * wait (0/1).                                *
+ * e.g. "hdd", "ssd,qd=4,fault=1000"          *
+ * return 0, -1 if spec is not valid          *
+ *********************************************/
+int32_t devStart (const char *spec) {
+	char buf[CMDE_LENGTH + 1];
+	snprintf (buf, sizeof (buf), "%s", spec);
+
+	model = profiles[0];
+	char *rest = buf;
+	char *tok;
+	while ((tok = getToken (&rest, ',')) != NULL) {
+		char *eq = strchr (tok, '=');
+		if (eq == NULL) {
+			int32_t i = 0;
+			while (i < PROFILECNT && strcmp (profiles[i].name, tok) != 0) {
+				i++;
+			}
+			if (i == PROFILECNT) {
+				printf ("dev: unknown profile %s\n", tok);
+				return -1;
+			}
+			model = profiles[i];
+		} else {
+			*eq = 0;
+			if (setKey (tok, atoll (eq + 1)) != 0) {
+				printf ("dev: unknown key %s\n", tok);
+				return -1;
+			}
+		}
+	}
+	if (model.qd < 1 || model.qd > DEV_MAXQD || model.lat < 0 || model.bw < 0
+	|| model.seek < 0 || model.fault < 0) {
+		printf ("dev: bad value in %s\n", spec);
+		return -1;
+	}
+	model.name = (strchr (spec, '=') == NULL) ? model.name : "custom";
+
+	for (int32_t c=0; c<DEV_MAXQD; c++) {
+		chanFree[c] = 0;
+	}
+	now = startNs = 0;
+	wakeAt = 0;
+	prevFirst = prevLast = -1;
+	free (faultMap);
+	faultMap = calloc (((SuperBlock_t *)disk)->blockCnt, 1);
+	assert (faultMap != NULL);
+	memset (ioCnt, 0, sizeof (ioCnt));
+	memset (byteCnt, 0, sizeof (byteCnt));
+	seqCnt = faults = busyNs = queueNs = 0;
+	devActive = TRUE;
+	return 0;
+}//devStart
+
+/**********************************************
+ * Charge one I/O of kind (DEV_READ/WRITE/    *
+ * TRIM) on the blocks covering len bytes     *
+ * from addr. Called through devAccess.       *
+ * return 0, -5 if the read failed            *
+ *********************************************/
+int32_t devIO (const void *addr, int64_t len, int8_t kind) {
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	int64_t first = geo->blockOf (addr);
+	int64_t last = geo->blockOf ((const char *)addr + len - 1);
+	int64_t bytes = (last - first + 1) * sb->blockSize;
+
+	pthread_mutex_lock (&lock);
+	int64_t cost = model.lat;
+	if (model.bw != 0) {
+		cost += bytes * 1000000000LL / model.bw;
+	}
+	// No seek for the block(s) just accessed or the next one
+	if (prevFirst != -1 && first >= prevFirst && first <= prevLast + 1) {
+		seqCnt++;
+	} else if (model.seek != 0 && prevFirst != -1) {
+		int64_t dist = (first > prevLast) ? first - prevLast : prevFirst - first;
+		cost += model.seek / 2 + model.seek / 2 * dist / sb->blockCnt;
+	}
+	prevFirst = first;
+	prevLast = last;
+	int32_t retVal = 0;
+	if (kind == DEV_READ && model.fault != 0 && nextRandom () % model.fault == 0) {
+		faults++;
+		retVal = -5;
+	}
+
+	// First channel to be free
+	int32_t c = 0;
+	for (int32_t i=1; i<model.qd; i++) {
+		if (chanFree[i] < chanFree[c]) {
+			c = i;
+		}
+	}
+	int64_t start = (chanFree[c] > now) ? chanFree[c] : now;
+	queueNs += start - now;
+	chanFree[c] = start + cost;
+	busyNs += cost;
+	ioCnt[kind]++;
+	byteCnt[kind] += bytes;
+	int64_t until = 0;
+	if (kind == DEV_READ) {
+		int64_t waitNs = chanFree[c] - now;
+		now = chanFree[c];
+		if (model.wait) {
+			// Deadlines chain while vsfs keeps reading, so time overslept
+			// on one read is taken off the next; after an idle spell
+			// (shell input, replay pacing) the wait starts afresh
+			int64_t t = wallNs ();
+			wakeAt = ((t - wakeAt < DEV_SLACK) ? wakeAt : t) + waitNs;
+			until = wakeAt;
+		}
+	}
+	pthread_mutex_unlock (&lock);
+
+	// Reported by the read that failed
+	if (retVal != 0) {
+		printf ("I/O error in block %lld\n", (long long)first);
+	}
+	// An absolute deadline: a sleep cut short by a signal resumes
+	// without drifting
+	if (until > wallNs ()) {
+		struct timespec t = {until / 1000000000LL, until % 1000000000LL};
+		while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR) {
+			;
+		}
+	}
+	return retVal;
+}//devIO
+
+/**********************************************
+ * TRUE <=> a read of block b through         *
+ * getDataBlock/getInode failed and was not   *
+ * reported yet (it is reported once).        *
+ *********************************************/
+bool devFault (int64_t b) {
+	// The model is fixed once the device is set up: no lock needed
+	if (!devActive || model.fault == 0) {
+		return FALSE;
+	}
+	// faultMap changes under the lock with every read
+	pthread_mutex_lock (&lock);
+	bool hit = faultMap[b];
+	faultMap[b] = FALSE;
+	pthread_mutex_unlock (&lock);
+	return hit;
+}//devFault
+
+/**********************************************
+ * Display the I/O counters of the device     *
+ *********************************************/
+void devReport () {
+	if (!devActive) {
+		printf ("no device model (run with -dev)\n");
+		return;
+	}
+	pthread_mutex_lock (&lock);
+	int64_t total = ioCnt[DEV_READ] + ioCnt[DEV_WRITE] + ioCnt[DEV_TRIM];
+	printf ("device %s: lat %lld ns, bw %lld B/s, qd %d, seek %lld ns", model.name,
+		(long long)model.lat, (long long)model.bw, model.qd, (long long)model.seek);
+	if (model.fault != 0) {
+		printf (", 1 read in %lld fails", (long long)model.fault);
+	}
+	printf ("%s\n", model.wait ? ", waiting" : "");
+	printf ("I/Os: %lld reads (%lld bytes), %lld writes (%lld bytes), %lld discards, %lld%% without seek\n",
+		(long long)ioCnt[DEV_READ], (long long)byteCnt[DEV_READ], (long long)ioCnt[DEV_WRITE],
+		(long long)byteCnt[DEV_WRITE], (long long)ioCnt[DEV_TRIM],
+		(long long)((total == 0) ? 0 : 100 * seqCnt / total));
+	// Posted writes and discards may still be in flight
+	int64_t drained = now;
+	for (int32_t c=0; c<model.qd; c++) {
+		if (chanFree[c] > drained) {
+			drained = chanFree[c];
+		}
+	}
+	printf ("time: %.3f ms elapsed (%.3f ms with posted I/O), %.3f ms busy, %.3f ms queued, %.2f us per I/O, %lld faults\n",
+		(now - startNs) / 1e6, (drained - startNs) / 1e6, busyNs / 1e6, queueNs / 1e6,
+		(total == 0) ? 0.0 : busyNs / 1e3 / total, (long long)faults);
+	pthread_mutex_unlock (&lock);
+}//devReport
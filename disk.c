@@ -15,17 +15,27 @@ typedef struct Symbol {
 } Symbol;
 
 static Symbol lookupTable [CMDCNT] = {
- {"help", HELP}, {"dpd", DUMPDISK}, {"dpbm", DUMPBITMAP}, {"dpi", DUMPINODE}, {"dpbl", DUMPBLOCK}, {"dpbld", DUMPBLOCKDIR}, {"ls", LS}, {"cd", CD}, {"make", MAK}, {"mkdir", MKD}, {"rmf", RMF}, {"rmd", RMD}, {"q", QUIT}
+ {"help", HELP}, {"dpd", DUMPDISK}, {"dpbm", DUMPBITMAP}, {"dpi", DUMPINODE}, {"dpbl", DUMPBLOCK}, {"dpbld", DUMPBLOCKDIR}, {"ls", LS}, {"cd", CD}, {"make", MAK}, {"mkdir", MKD}, {"rmf", RMF}, {"rmd", RMD}, {"df", DF}, {"write", WRITE}, {"cat", CAT}, {"zip", ZIP}, {"unzip", UNZIP}, {"dedup", DEDUP}, {"fsck", FSCK}, {"du", DU}, {"find", FIND}, {"iostat", IOSTAT}, {"q", QUIT}
 };
 
 char *currDir;	// Current Directory (to display as prompt)
 void *disk;
+
+Parameters parameters;
+int paramDebug;
 /************************************************************************
  * Mount disk and its file system: we don't attach the new file system  *
  * to a mount point (as Unix does). We only prepare for vsfs to be used *
  * - verify the signature in superblock                                 *
  * - create the root directory (named "/")                              *
  * - initialize currDir to the root                                     *
+ * - select the hot paths specialised for the disk geometry             *
+ * - reset the iNode allocator and build the free-extent index of data  *
+ *   blocks                                                             *
+ * - build reference counts and hash index of data blocks               *
+ * - compute the checksum of every block                                *
+ * - start the thread clearing freed data blocks                        *
+ * - publish a shared disk to readers                                   *
  ***********************************************************************/
 void vsfs_mount () {
     // Verify the signature in superblock
@@ -33,17 +43,22 @@ void vsfs_mount () {
 	SuperBlock_t *p = (SuperBlock_t*)disk;
 
 	assert(p->signature == MAGICNB);
-	int32_t numInode = getFreeInodeNb();
+	assert(p->version == VSFS_VERSION);
+	int64_t numInode = getFreeInodeNb();
 	assert(numInode == 0);
 
-	int32_t num = getFreeDataBlockNb();
+	int64_t num = getFreeDataBlockNb();
 	assert(num == 0);
+	p->freeINodeCnt--;
+	p->freeDataCnt--;
+	csumUpdate(p, sizeof (SuperBlock_t));
 
     // Create the root directory (named "/")
 	Inode_t *node = getInode (numInode);
     node->number = numInode;
 	node->ptr[0] = num;
 	node->type = FT_DIR;
+	node->subBlocks = 1;
 
 	for(int i=1; i<parameters.directCnt; ++i){
 		node->ptr[i] = -1;
@@ -57,32 +72,97 @@ void vsfs_mount () {
     strcpy (root->fileName, "/");
     // Initialize currDir to the root
 	strcpy(currDir, "/");
+
+	// Hot paths of this geometry, then in-memory indexes
+	geometrySelect();
+	// iNodes and data blocks are allocated through these from now on
+	iNodeBuild();
+	extentBuild();
+	dedupBuild();
+	csumBuild();
+	reclaimStart();
+	// Readers of a shared disk may attach from now on
+	shmPublish();
 }//vsfs_mount
 
+/***********************************************
+ * Sizes (in blocks) of the bit maps and of the *
+ * iNode table on a disk of blockCnt blocks     *
+ **********************************************/
+static void diskLayout (int64_t blockCnt, int64_t *iNodeBMSize, int64_t *dataBMSize, int64_t *iNodeTabSize) {
+	int64_t bitsPerBlock = (int64_t)parameters.blockSize * 8;
+	*iNodeTabSize = (blockCnt / INODE_RATIO * (int64_t)sizeof (Inode_t)
+		+ parameters.blockSize - 1) / parameters.blockSize;
+	if (*iNodeTabSize < parameters.iNodeTabSize) {
+		*iNodeTabSize = parameters.iNodeTabSize;
+	}
+	int64_t iNodeCnt = *iNodeTabSize * parameters.blockSize / (int64_t)sizeof (Inode_t);
+	*iNodeBMSize = (iNodeCnt + bitsPerBlock - 1) / bitsPerBlock;
+	if (*iNodeBMSize < parameters.iNodeBMSize) {
+		*iNodeBMSize = parameters.iNodeBMSize;
+	}
+	*dataBMSize = (blockCnt + bitsPerBlock - 1) / bitsPerBlock;
+	if (*dataBMSize < parameters.dataBMSize) {
+		*dataBMSize = parameters.dataBMSize;
+	}
+}//diskLayout
+
+/***********************************************
+ * Smallest disk holding its metadata, its      *
+ * checksum table and one data block (the root  *
+ * directory)                                   *
+ **********************************************/
+static int64_t diskMinBlocks () {
+	for (int64_t n=1; ; n++) {
+		int64_t iNodeBMSize, dataBMSize, iNodeTabSize;
+		diskLayout (n, &iNodeBMSize, &dataBMSize, &iNodeTabSize);
+		int64_t csumBlocks = (n * (int64_t)sizeof (uint32_t) + parameters.blockSize - 1) / parameters.blockSize;
+		if (n - 1 - iNodeBMSize - dataBMSize - iNodeTabSize - csumBlocks >= 1) {
+			return n;
+		}
+	}
+}//diskMinBlocks
+
 /***********************************************
  * Create a virtual disk with blockCnt blocks. *
  * Params points to a Parameters structure     *
  * defined in vsfs.h containing value either   *
  * default or populated from parameter file.   *
+ * On large disks the bit maps and the iNode   *
+ * table grow past those values: the data bit  *
+ * map covers every block and the table holds  *
+ * one iNode per INODE_RATIO blocks.           *
  **********************************************/
-void vsfs_initDisk (int32_t blockCnt) {
-	int32_t diskSize = parameters.blockSize * blockCnt;
-	disk = malloc (diskSize);
+void vsfs_initDisk (int64_t blockCnt) {
+	int64_t diskSize = (int64_t)parameters.blockSize * blockCnt;
+	// zeroed disk: the shared mapping made by shmCreate, else calloc
+	// (which lets the system hand out zero pages lazily)
+	disk = shmShared () ? shmDisk () : calloc (diskSize, 1);
 	assert (disk != NULL);
 
-	// zero the disk
-	memset (disk, 0, diskSize);
+	int64_t iNodeBMSize, dataBMSize, iNodeTabSize;
+	diskLayout (blockCnt, &iNodeBMSize, &dataBMSize, &iNodeTabSize);
+	int64_t iNodeCnt = iNodeTabSize * parameters.blockSize / (int64_t)sizeof (Inode_t);
 
 	// Create superblock with ad hoc values
 	SuperBlock_t *sb = (SuperBlock_t *) disk;
 	sb->signature = MAGICNB;
+	sb->version = VSFS_VERSION;
  	sb->blockCnt = blockCnt;
  	sb->blockSize = parameters.blockSize;
-	sb->iNodeBMSize = parameters.iNodeBMSize;
-	sb->dataBMSize = parameters.dataBMSize;
- 	sb->iNodeTabSize = parameters.iNodeTabSize;
+	sb->iNodeBMSize = iNodeBMSize;
+	sb->dataBMSize = dataBMSize;
+ 	sb->iNodeTabSize = iNodeTabSize;
 
  	sb->iNodeSize = sizeof(Inode_t);
+	sb->flags = parameters.compress ? SB_COMPRESS : 0;
+
+	// Usage counters, kept up to date by the allocators
+	sb->freeINodeCnt = iNodeCnt;
+	sb->freeDataCnt = blockCnt - 1 - iNodeBMSize - dataBMSize - iNodeTabSize;
+
+	// Checksum table at the end of the disk
+	csumFormat ();
 
 	// Reserve space for the currDir. Will be set up in vsfs_mount
 	currDir = (char *)(malloc (PATH_MAXLEN*sizeof(char)));
@@ -90,6 +170,267 @@ void vsfs_initDisk (int32_t blockCnt) {
 
 }//vsfs_initDisk
 
+// Max bytes in a (compressed) file: four times what the direct
+// blocks of an iNode hold
+static int32_t fileMaxSize () {
+	return 4 * parameters.directCnt * ((SuperBlock_t *)disk)->blockSize;
+}
+
+/**************************************************
+ * Store len bytes of buf as the content of iNode *
+ * node. Data is compressed when the file asks    *
+ * for it and it saves space. A block identical   *
+ * to an existing one shares it; a shared block   *
+ * is never written in place.                     *
+ * return 0 on success                            *
+ *        -1 no space available                   *
+ *        -4 content too large                    *
+ *************************************************/
+static int32_t writeData (Inode_t *node, const char *buf, int32_t len) {
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	int32_t blockSize = sb->blockSize;
+	int32_t cap = parameters.directCnt * blockSize;
+	char packed[cap];
+	const char *src = buf;
+	int32_t stored = len;
+	int8_t flags = node->flags & ~IN_ZDATA;
+
+	if (len < 0 || len > fileMaxSize ()) {
+		return -4;
+	}
+	if (node->flags & IN_COMPRESS) {
+		int32_t cLen = lzCompress (buf, len, packed, cap);
+		if (cLen != -1 && cLen < len) {
+			src = packed;
+			stored = cLen;
+			flags |= IN_ZDATA;
+		}
+	}
+	if (stored > cap) {
+		return -4;
+	}
+
+	// Lay the stored bytes out in zero padded blocks
+	int32_t need = (stored + blockSize - 1) / blockSize;
+	char blocks[cap];
+	memcpy (blocks, src, stored);
+	memset (blocks + stored, 0, need * blockSize - stored);
+
+	int64_t old[DIRECTCNT];
+	int64_t newPtr[DIRECTCNT];
+	int8_t write[DIRECTCNT];			// TRUE <=> newPtr[i] gets blocks[i]
+	for (int32_t i=0; i<parameters.directCnt; i++) {
+		old[i] = node->ptr[i];
+		newPtr[i] = -1;
+		write[i] = FALSE;
+	}
+
+	// Share blocks identical to existing ones (this takes a reference)
+	for (int32_t i=0; i<need; i++) {
+		newPtr[i] = dedupFind (blocks + i * blockSize);
+	}
+	// Other blocks reuse our own block when nobody else shares it,
+	// otherwise get a new one. Nothing is written before all are found
+	// so that a failure leaves the file untouched.
+	for (int32_t i=0; i<need; i++) {
+		if (newPtr[i] != -1) {
+			continue;
+		}
+		if (old[i] != -1 && dedupRefCnt (old[i]) == 1) {
+			newPtr[i] = old[i];
+			old[i] = -1;
+		} else {
+			newPtr[i] = (i > 0) ? extentAllocAt (newPtr[i-1] + 1, 1) : -1;
+			if (newPtr[i] == -1) {
+				newPtr[i] = extentAlloc (1);
+			}
+			if (newPtr[i] == -1) {
+				for (int32_t j=0; j<need; j++) {
+					if (newPtr[j] == -1) {
+						continue;
+					}
+					if (newPtr[j] == node->ptr[j] && write[j]) {
+						old[j] = newPtr[j];
+					} else if (write[j]) {
+						extentFree (newPtr[j], 1);
+					} else {
+						dedupUnref (newPtr[j]);
+					}
+				}
+				return -1;
+			}
+		}
+		write[i] = TRUE;
+	}
+
+	for (int32_t i=0; i<need; i++) {
+		if (write[i]) {
+			if (newPtr[i] == node->ptr[i]) {
+				dedupUnindex (newPtr[i]);
+			}
+			memcpy (getDataBlock (newPtr[i]), blocks + i * blockSize, blockSize);
+			csumUpdate (getDataBlock (newPtr[i]), blockSize);
+			dedupHold (newPtr[i], TRUE);
+		}
+	}
+	// Drop the blocks of the previous content
+	for (int32_t i=0; i<parameters.directCnt; i++) {
+		if (old[i] != -1 && dedupUnref (old[i]) == 0) {
+			reclaimBlock (old[i]);
+		}
+		node->ptr[i] = newPtr[i];
+	}
+	node->size = len;
+	node->storedSize = stored;
+	node->flags = flags;
+	csumUpdate (node, sizeof (Inode_t));
+	return 0;
+}//writeData
+
+/**************************************************
+ * Copy up to len bytes of the content of iNode   *
+ * node into buf, decompressing if needed.        *
+ * return number of bytes copied                  *
+ *        -5 data is corrupted                    *
+ *************************************************/
+static int32_t readData (Inode_t *node, char *buf, int32_t len) {
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	int32_t blockSize = sb->blockSize;
+	char packed[parameters.directCnt * blockSize];
+	char plain[fileMaxSize ()];
+
+	if (csumCheck (node, sizeof (Inode_t)) != 0) {
+		return -5;
+	}
+	// Gather stored bytes
+	for (int32_t i=0; i * blockSize < node->storedSize; i++) {
+		int64_t n = node->storedSize - i * blockSize;
+		if (csumCheck (getDataBlock (node->ptr[i]), blockSize) != 0) {
+			return -5;
+		}
+		memcpy (packed + i * blockSize, getDataBlock (node->ptr[i]), (n > blockSize) ? blockSize : n);
+	}
+
+	const char *src = packed;
+	int32_t size = (int32_t)node->storedSize;
+	if (node->flags & IN_ZDATA) {
+		size = lzDecompress (packed, size, plain, sizeof (plain));
+		if (size != node->size) {
+			return -5;
+		}
+		src = plain;
+	}
+	if (size > len) {
+		size = len;
+	}
+	memcpy (buf, src, size);
+	return size;
+}//readData
+
+/**************************************************
+ * Fill a new directory: dot and dot-dot entries  *
+ * in its first block. Data files get their       *
+ * placeholder text in create, before the entry   *
+ * is placed.                                     *
+ *************************************************/
+static void initContent (int64_t num, int64_t upperNode, int8_t ft) {
+	Inode_t *node = getInode (num);
+	if (ft == FT_DIR) {
+		int64_t bNum = node->ptr[0];
+		char *temp = (char*)getDataBlock(bNum) + sizeof (DirEntry_t);
+		DirEntry_t *dot = (DirEntry_t*)(char*)getDataBlock(bNum);
+		DirEntry_t *doubleDot = (DirEntry_t *)temp;
+		strcpy(dot->fileName, ".");
+		dot->iNodeNb = num;
+		dot->next = doubleDot;
+		strcpy(doubleDot->fileName, "..");
+		doubleDot->iNodeNb = upperNode;
+		doubleDot->next = NULL;
+		csumUpdate (dot, 2 * sizeof (DirEntry_t));
+	}
+}//initContent
+
+/**************************************************
+ * Verify a directory before its chains are       *
+ * followed: the checksums of its iNode and data  *
+ * blocks, and that every next pointer stays in   *
+ * its block.                                     *
+ * return 0 if intact, -5 if corrupted            *
+ *************************************************/
+static int32_t checkDir (int64_t iNodeNb) {
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	Inode_t *node = getInode (iNodeNb);
+
+	if (csumCheck (node, sizeof (Inode_t)) != 0 || node->type != FT_DIR) {
+		return -5;
+	}
+	for (int32_t i=0; i<parameters.directCnt && node->ptr[i] != -1; i++) {
+		char *block = (char *)getDataBlock (node->ptr[i]);
+		if (csumCheck (block, sb->blockSize) != 0) {
+			return -5;
+		}
+		for (DirEntry_t *e = (DirEntry_t *)block; e->next != NULL; e = e->next) {
+			if ((char *)e->next <= (char *)e
+			|| (char *)e->next + sizeof (DirEntry_t) > block + sb->blockSize) {
+				printf ("bad entry chain in block %lld\n", (long long)node->ptr[i]);
+				return -5;
+			}
+		}
+	}
+	return 0;
+}//checkDir
+
+/*************************************************
+ * iNode number of absolute path, whose last     *
+ * name is of type ft, found from the root with  *
+ * geo->lookup. Unlike getInodeNbFromPath, whose *
+ * reads stay inside library.c where the link-   *
+ * time wrapping can't see them, every iNode and *
+ * directory block read is charged to the device *
+ * return iNode number, -1 if none               *
+ *        -5 I/O error                           *
+ ************************************************/
+int64_t pathLookup (const char *path, int8_t ft) {
+	char name[FILENAME_LENGTH + 1];
+	int64_t num = 0;
+
+	const char *p = path;
+	while (*p == '/') {
+		p++;
+	}
+	while (*p != 0) {
+		size_t len = strcspn (p, "/");
+		if (len > FILENAME_LENGTH) {
+			return -1;
+		}
+		memcpy (name, p, len);
+		name[len] = 0;
+		p += len;
+		while (*p == '/') {
+			p++;
+		}
+		num = geo->lookup (num, name, (*p == 0) ? ft : FT_DIR);
+		if (num < 0) {
+			return num;
+		}
+	}
+	return num;
+}//pathLookup
+
+// Add new file num (with its blocks) to the aggregates of directory
+// upperNode and above; grew is the number of blocks upperNode gained.
+static void accountNew (int64_t upperNode, int64_t num, int64_t grew) {
+	Inode_t *node = getInode (num);
+	subtreeAdd (upperNode, 1, grew + ((node->type == FT_DIR) ? node->subBlocks : subtreeOwnBlocks (node)));
+	subtreeDepthAdd (upperNode, 1 + ((node->type == FT_DIR) ? node->subDepth : 0));
+}
+
+// Store name zero padded so that lookups compare fixed-size keys
+static void setEntryName (DirEntry_t *entry, const char *name) {
+	memset (entry->fileName, 0, FILENAME_LENGTH);
+	memcpy (entry->fileName, name, strlen (name));
+}
+
 /******************************************
  * Create a file in the current directory *
  * Parameters: name of file               *
@@ -97,8 +438,10 @@ void vsfs_initDisk (int32_t blockCnt) {
  * return -1 if no space available        *
  *        -2 duplicate file name          *
  *        -3 incorrect file name (length) *
+ *        -5 corrupted directory or I/O   *
+ *           error                        *
  *****************************************/
-int32_t vsfs_create (char *name, int8_t ft) {
+static int32_t create (char *name, int8_t ft) {
 	assert(disk != NULL);
 	SuperBlock_t *block = (SuperBlock_t*)disk;
 
@@ -106,12 +449,30 @@ int32_t vsfs_create (char *name, int8_t ft) {
 	if(strlen(name) > FILENAME_LENGTH){
         return -3;
     }
+	// Return -1 at once when the disk is full: a new file needs an
+	// iNode and a data block (its content or its first directory block).
+	// Blocks waiting to be reclaimed are freed first.
+	if (block->freeDataCnt == 0) {
+		reclaimDrain ();
+	}
+	if (block->freeINodeCnt == 0 || block->freeDataCnt == 0) {
+		return -1;
+	}
 
-	int32_t upperNode = getInodeNbFromPath(currDir, FT_DIR);
+	int64_t upperNode = pathLookup (currDir, FT_DIR);
+	if (upperNode == -5) {
+		return -5;
+	}
 	assert(upperNode >= 0);
+	if (checkDir (upperNode) != 0) {
+		return -5;
+	}
 
 	// Return -2 if duplicate file name
-	int32_t num = getInodeNbFromParent(upperNode, name, ft);
+	int64_t num = geo->lookup (upperNode, name, ft);
+	if (num == -5) {
+		return -5;
+	}
 	if (num != -1) {
 		return -2;
 	}
@@ -119,19 +480,45 @@ int32_t vsfs_create (char *name, int8_t ft) {
 	Inode_t *d = getInode (upperNode);
 	assert(d != NULL);
 
-    num = getFreeInodeNb ();
+    num = iNodeAlloc ();
+	if (num == -5) {
+		return -5;
+	}
 	assert(num > 0);
 
-	int32_t bNum = getFreeDataBlockNb();
-	assert(bNum > 0);
+	// Data file blocks are given by writeData
+	int64_t bNum = -1;
+	if (ft == FT_DIR) {
+		bNum = extentAlloc(1);
+		assert(bNum > 0);
+		dedupHold(bNum, FALSE);
+	}
 
 	Inode_t *node = getInode(num);
 	node->number = num;
 	node->type = ft;
+	node->flags = (ft == FT_FIL && (block->flags & SB_COMPRESS)) ? IN_COMPRESS : 0;
+	node->size = 0;
+	node->storedSize = 0;
+	node->subEntries = 0;
+	node->subBlocks = (bNum != -1) ? 1 : 0;
+	node->subDepth = 0;
 	node->ptr[0] = bNum;
 	for(int32_t i=1; i<parameters.directCnt; ++i) {
 		node->ptr[i] = -1;
     }
+	csumUpdate (node, sizeof (Inode_t));
+
+	// The placeholder text is stored first, so that growing the parent
+	// can't take the block the file needs and leave it without content
+	if (ft == FT_FIL) {
+		char msg[80];
+		sprintf (msg, "%s is empty", name);
+		if (writeData (node, msg, strlen (msg)) != 0) {
+			iNodeFree (num);
+			return -1;
+		}
+	}
 
     assert (disk != NULL);
 	SuperBlock_t *sb = (SuperBlock_t *)disk;
@@ -141,36 +528,29 @@ int32_t vsfs_create (char *name, int8_t ft) {
 
     // Find Available space
     for (int i=0; i<DIRECTCNT; i++) {
-		int32_t numB = pNode->ptr[i];
+		int64_t numB = pNode->ptr[i];
 		if (numB == -1) {
-			numB = getFreeDataBlockNb ();
-			assert(numB != -1);
+			// Keep the directory contiguous when the next block is free
+			numB = (i > 0) ? extentAllocAt (pNode->ptr[i-1] + 1, 1) : -1;
+			if (numB == -1) {
+				numB = extentAlloc (1);
+			}
+			if (numB == -1) {
+				break;
+			}
+			dedupHold(numB, FALSE);
 			pNode->ptr[i] = numB;
+			csumUpdate (pNode, sizeof (Inode_t));
 
 			DirEntry_t *entry = (DirEntry_t *) getDataBlock (numB);
 			assert(entry != NULL);
 
 			entry->next = NULL;
-			strcpy(entry->fileName, name);
+			setEntryName (entry, name);
 			entry->iNodeNb = num;
-            //check ft is a file or file block
-            if (ft == FT_FIL) {
-		        char *mem = (char*)getDataBlock(bNum);
-		        char msg[80];
-		        sprintf(msg, "%s is empty", name);
-		        strcpy(mem, msg);
-	        }
-	        else if (ft == FT_DIR) {
-		        char *temp = (char*)getDataBlock(bNum) + sizeof (DirEntry_t);
-		        DirEntry_t *dot = (DirEntry_t*)(char*)getDataBlock(bNum);
-		        DirEntry_t *doubleDot = (DirEntry_t *)temp;
-		        strcpy(dot->fileName, ".");
-		        dot->iNodeNb = num;
-		        dot->next = doubleDot;
-		        strcpy(doubleDot->fileName, "..");
-		        doubleDot->iNodeNb = upperNode;
-		        doubleDot->next = NULL;
-            }
+			csumUpdate (entry, sizeof (DirEntry_t));
+            initContent (num, upperNode, ft);
+            accountNew (upperNode, num, 1);
             return 0;
         }
         DirEntry_t *size = (DirEntry_t *)getDataBlock (numB);
@@ -179,27 +559,12 @@ int32_t vsfs_create (char *name, int8_t ft) {
         DirEntry_t *dir = size;
 		while(dir->next != NULL) {
 			if (dir->iNodeNb == -1) {
-				strcpy (dir->fileName, name);
+				setEntryName (dir, name);
 				dir->iNodeNb = num;
-                //check ft is a file or file block
-                if (ft == FT_FIL) {
-		            char *mem = (char*)getDataBlock(bNum);
-		            char msg[80];
-		            sprintf (msg, "%s is empty", name);
-		            strcpy(mem, msg);
-	            }
-	            else if (ft == FT_DIR) {
-	                char *temp = (char*)getDataBlock(bNum) + sizeof (DirEntry_t);
-	                DirEntry_t *dot = (DirEntry_t*)(char*)getDataBlock(bNum);
-                    DirEntry_t *doubleDot = (DirEntry_t *)temp;
-		            strcpy(dot->fileName, ".");
-		            dot->iNodeNb = num;
-		            dot->next = doubleDot;
-		            strcpy(doubleDot->fileName, "..");
-		            doubleDot->iNodeNb = upperNode;
-	                doubleDot->next = NULL;
-	            }
-			    return 0;
+				csumUpdate (dir, sizeof (DirEntry_t));
+                initContent (num, upperNode, ft);
+                accountNew (upperNode, num, 0);
+                return 0;
             }
 		    dir = dir->next;
         }
@@ -211,46 +576,35 @@ int32_t vsfs_create (char *name, int8_t ft) {
 		    DirEntry_t *new = (DirEntry_t *) newAddress;
 		    dir->next = new;
 		    new->next = NULL;
-		    strcpy (new->fileName, name);
+		    setEntryName (new, name);
 		    new->iNodeNb = num;
-            // Check if ft is a file or file block
-            if (ft == FT_FIL) {
-		        char *mem = (char*)getDataBlock(bNum);
-		        char msg[80];
-		        sprintf (msg, "%s is empty", name);
-		        strcpy(mem, msg);
-	        }
-	        else if (ft == FT_DIR) {
-		        char *temp = (char*)getDataBlock(bNum) + sizeof (DirEntry_t);
-		        DirEntry_t *dot = (DirEntry_t*)(char*)getDataBlock(bNum);
-		        DirEntry_t *doubleDot = (DirEntry_t *)temp;
-		        strcpy(dot->fileName, ".");
-		        dot->iNodeNb = num;
-		        dot->next = doubleDot;
-		        strcpy(doubleDot->fileName, "..");
-		        doubleDot->iNodeNb = upperNode;
-		        doubleDot->next = NULL;
-	        }
-		    return 0;
+		    csumUpdate (dir, 2 * sizeof (DirEntry_t));
+            initContent (num, upperNode, ft);
+            accountNew (upperNode, num, 0);
+            return 0;
 	    }
     }
 
     // If no room is available return -1
     printf ("No room for file %s\n", name);
-	void *mem = (int8_t *) (disk + block->blockSize);
-	resetBitInBB (mem, num);
-	mem = (int8_t *) (disk + block->blockSize + block->blockSize * block->iNodeBMSize);
-	resetBitInBB (mem, bNum);
+	iNodeFree (num);
+	if (bNum != -1) {
+		dedupUnref (bNum);
+		extentFree (bNum, 1);
+	}
+	for (int32_t i=0; ft == FT_FIL && i<parameters.directCnt; i++) {
+		if (node->ptr[i] != -1 && dedupUnref (node->ptr[i]) == 0) {
+			reclaimBlock (node->ptr[i]);
+		}
+	}
 	return -1;
 }//create
 
 /****************************
  * Change current directory *
  ***************************/
-void vsfs_CD (char *dirName){
-    char *mem = malloc (FILENAME_LENGTH + sizeof (*currDir));
-	assert(mem != 0);
-    strcpy(mem, currDir);
+static void changeDir (char *dirName){
+	char mem[PATH_MAXLEN + 1];	// scratch path, no heap allocation per call
 
     if (strcmp(dirName, "..") == 0) {
 		// Go up one level if possible
@@ -263,6 +617,11 @@ void vsfs_CD (char *dirName){
 		return;
 	}
     // CD xxx if xxx is an existing sub directory
+	if (strlen(currDir) + 1 + strlen(dirName) > PATH_MAXLEN - 1) {
+		printf("%s: path too long\n", dirName);
+		return;
+	}
+	strcpy(mem, currDir);
 	if (strcmp(currDir, "/") == 0 ) {
         strcat(mem, dirName);
     }
@@ -271,8 +630,8 @@ void vsfs_CD (char *dirName){
         strcat(mem, dirName);
 	}
 
-	if (getInodeNbFromPath(mem, FT_DIR) != -1
-    && isDirectory(getInodeNbFromPath(mem, FT_DIR))) {
+	// The lookup matches directories only
+	if (pathLookup (mem, FT_DIR) >= 0) {
 		strcpy(currDir, mem);
 		return;
 	}
@@ -280,83 +639,169 @@ void vsfs_CD (char *dirName){
     // If the parameter is not an existing sub directory,
     // display a message “no such file or directory
 	printf("%s no such file or directory\n", dirName);
-	free(mem);
 }
 
+/**********************************************
+ * Position a cursor at the first entry of    *
+ * directory path.                            *
+ * return 0 on success                        *
+ *        -1 no such directory                *
+ *        -5 I/O error                        *
+ *********************************************/
+static int32_t openDir (char *path, DirCursor_t *cursor) {
+	assert(cursor != NULL);
+
+	int64_t num = pathLookup (path, FT_DIR);
+	if (num < 0) {
+		return (int32_t)num;
+	}
+
+	cursor->iNodeNb = num;
+	cursor->ptrIdx = 0;
+	cursor->offset = 0;
+	return 0;
+}//openDir
+
+/************************************************
+ * Read up to cnt entries of the directory into *
+ * buf, starting where the cursor stands, and   *
+ * advance the cursor. Free slots are skipped.  *
+ * return number of entries filled (0 at end)   *
+ *        -5 corrupted directory                *
+ ***********************************************/
+int32_t dirRead (DirCursor_t *cursor, Dirent_t *buf, int32_t cnt) {
+	assert(cursor != NULL);
+	assert(buf != NULL);
+
+	Inode_t *node = getInode(cursor->iNodeNb);
+	if (csumCheck (node, sizeof (Inode_t)) != 0) {
+		return -5;
+	}
+	assert(node->type == FT_DIR);
+	int32_t blockSize = ((SuperBlock_t *)disk)->blockSize;
+
+	int32_t filled = 0;
+	while (filled < cnt && cursor->offset != -1) {
+		if (cursor->ptrIdx >= parameters.directCnt
+		|| node->ptr[cursor->ptrIdx] == -1) {
+			cursor->offset = -1;
+			break;
+		}
+		char *block = (char*)getDataBlock(node->ptr[cursor->ptrIdx]);
+		DirEntry_t *curr = (DirEntry_t*)(block + cursor->offset);
+		if (csumCheck (block, blockSize) != 0) {
+			return -5;
+		}
+		while (curr != NULL && filled < cnt) {
+			if (curr->iNodeNb != -1) {
+				Dirent_t *d = &buf[filled++];
+				d->iNodeNb = curr->iNodeNb;
+				d->type = getInode(curr->iNodeNb)->type;
+				strncpy(d->fileName, curr->fileName, FILENAME_LENGTH);
+				d->fileName[FILENAME_LENGTH] = 0;
+			}
+			curr = curr->next;
+			// A chain never leaves its block
+			if (curr != NULL && ((char*)curr < block
+			|| (char*)curr + sizeof (DirEntry_t) > block + blockSize)) {
+				return -5;
+			}
+		}
+
+		// Entries of a directory block are chained inside that block,
+		// so the position of the next one is stored as an offset.
+		if (curr != NULL) {
+			cursor->offset = (int32_t)((char*)curr - block);
+		} else {
+			cursor->ptrIdx++;
+			cursor->offset = 0;
+		}
+	}
+	return filled;
+}//dirRead
+
 /***********************************************
  * Display the files in the current directory. *
+ * Entries are fetched in batches and names    *
+ * are written through a local buffer.         *
  **********************************************/
-void vsfs_LS (){
-	int32_t num =  getInodeNbFromPath(currDir, FT_DIR);
-
-	// Make sure directory is not empty
-	if(getFileCnt(num) != 0) {
-
-	    Inode_t *node = getInode(num);
-	    assert(node->type == FT_DIR);
+static void listDir (){
+	DirCursor_t cursor;
+	Dirent_t ents[READDIR_BATCH];
+	char out[LS_BUFSIZE];
+	int32_t len = 0;
+	int32_t count = 0;			// names printed on the current line
+
+	if (openDir(currDir, &cursor) != 0) {
+		return;
+	}
 
-        // Count of files
-        int32_t count = 0;
-        // Loop through data
-	    for (int32_t i=0; i<parameters.directCnt; i++) {
-		    int32_t data = node->ptr[i];
-		    if (data == -1){
-                break;
-            }
-		    DirEntry_t *curr = (DirEntry_t*)getDataBlock(data);
-		    while (curr != NULL) {
-			    if (curr->iNodeNb != -1) {
-				    // Don’t print the files dot nor dot-dot
-				    if ((curr->iNodeNb != 0) &&
-					    (strcmp (curr->fileName, ".") != 0) &&
-					    (strcmp (curr->fileName, "..") != 0)){
-                        printf ("%s", curr->fileName);
-                        if(isDirectory(curr->iNodeNb)){
-						    // Print a star after any name which is a directory.
-						    printf ("*");
-                        }
-                        printf (" ");
-				    }
-                    // Count increments
-				    ++count;
-			    }
-			    curr = curr->next;
-			    if ((count % 8) == 0 ) {
-				    printf ("\n");
-                }
-            }
-	    }
-        printf ("\n");
-    }
-}
+	int32_t n;
+	while ((n = dirRead(&cursor, ents, READDIR_BATCH)) != 0) {
+		if (n < 0) {
+			printf ("Error %d in listing %s\n", n, currDir);
+			break;
+		}
+		for (int32_t i=0; i<n; i++) {
+			// Don’t print the root, dot nor dot-dot
+			if ((ents[i].iNodeNb == 0) ||
+				(strcmp (ents[i].fileName, ".") == 0) ||
+				(strcmp (ents[i].fileName, "..") == 0)) {
+				continue;
+			}
+			// Room for name, star, separator and newline
+			if (len + FILENAME_LENGTH + 3 > LS_BUFSIZE) {
+				fwrite(out, 1, len, stdout);
+				len = 0;
+			}
+			// Print a star after any name which is a directory.
+			len += sprintf(out + len, "%s%s ", ents[i].fileName,
+				(ents[i].type == FT_DIR) ? "*" : "");
+			if ((++count % 8) == 0) {
+				out[len++] = '\n';
+			}
+		}
+	}
+	if (count != 0) {
+		if ((count % 8) != 0) {
+			out[len++] = '\n';
+		}
+		fwrite(out, 1, len, stdout);
+	}
+}//listDir
 
 
 /****************************************
  * remove file in the current directory *
  * based on file name.                  *
  ***************************************/
-int32_t vsfs_RMF (char *name){
-	SuperBlock_t *block = (SuperBlock_t *) disk;
+static int32_t removeFile (char *name){
 
-	int32_t num = getInodeNbFromPath(currDir, FT_DIR);
+	int64_t num = pathLookup (currDir, FT_DIR);
+	if (num == -5) {
+		return -5;
+	}
 	assert(num >= 0);
+	if (checkDir (num) != 0) {
+		return -5;
+	}
 
     // Make sure there is a file
-	int32_t nodeNum = getInodeNbFromParent (num, name, FT_FIL);
-	if (nodeNum == -1){
-		return -1;
+	int64_t nodeNum = geo->lookup (num, name, FT_FIL);
+	if (nodeNum < 0){
+		return (int32_t)nodeNum;
     }
 
 	Inode_t *node = getInode(nodeNum);
-    void *mem;
+	if (csumCheck (node, sizeof (Inode_t)) != 0) {
+		return -5;
+	}
+	int64_t blocks = subtreeOwnBlocks (node);
     for(int32_t i=0; i<parameters.directCnt; ++i){
-        int32_t dataSeg = node->ptr[i];
-        // Clear the data block
-        if(dataSeg != -1) {
-            mem = (int8_t *) (disk + block->blockSize + block->blockSize*block->iNodeBMSize);
-            resetBitInBB (mem, dataSeg);
-            void *p = (void*)getDataBlock (dataSeg);
-            memset (p, 0, block->blockSize);
+        int64_t dataSeg = node->ptr[i];
+        // Queue the data block for clearing unless another file shares it
+        if(dataSeg != -1 && dedupUnref (dataSeg) == 0) {
+            reclaimBlock (dataSeg);
         }
     }
     // Update upper level directory
@@ -366,62 +811,162 @@ int32_t vsfs_RMF (char *name){
     Inode_t *upper = getInode(num);
     assert (upper->type == FT_DIR);
 
-    for(int32_t i=0; i<DIRECTCNT; ++i) {
+    for(int32_t i=0; i<DIRECTCNT && result == -1; ++i) {
         if (upper->ptr[i] == -1) {
-            result = -1;
+            break;
         }
         DirEntry_t *dir = (DirEntry_t *) getDataBlock (upper->ptr[i]);
         assert (dir != NULL);
 
-        while (dir->next != NULL) {
+        while (dir != NULL) {
             if (dir->iNodeNb == nodeNum) {
                 dir->iNodeNb = -1;
+                csumUpdate (dir, sizeof (DirEntry_t));
                 result = 0;
+                break;
             }
             dir = dir->next;
         }
     }
 
     if (result != -1) {
-        mem = (int8_t *) (disk + block->blockSize);
-        resetBitInBB (mem, nodeNum);
+        iNodeFree (nodeNum);
+        subtreeAdd (num, -1, -blocks);
+        subtreeDepthRemove (num, 1);
     }
 
 	return result;
-}//vsfs_RMF
+}//removeFile
+
+/****************************************
+ * Replace the content of file name in  *
+ * the current directory by len bytes   *
+ * of buf.                              *
+ * return 0 on success                  *
+ *        -1 no such file or no space   *
+ *        -4 content too large          *
+ *        -5 corrupted iNode or I/O     *
+ *           error                      *
+ ***************************************/
+static int32_t writeFile (char *name, char *buf, int32_t len) {
+	int64_t num = pathLookup (currDir, FT_DIR);
+	if (num == -5) {
+		return -5;
+	}
+	assert(num >= 0);
+
+	int64_t nodeNum = geo->lookup (num, name, FT_FIL);
+	if (nodeNum < 0) {
+		return (int32_t)nodeNum;
+	}
+	Inode_t *node = getInode (nodeNum);
+	if (csumCheck (node, sizeof (Inode_t)) != 0) {
+		return -5;
+	}
+	int64_t before = subtreeOwnBlocks (node);
+	int32_t retVal = writeData (node, buf, len);
+	subtreeAdd (num, 0, subtreeOwnBlocks (node) - before);
+	return retVal;
+}//writeFile
+
+/****************************************
+ * Read up to len bytes of file name in *
+ * the current directory into buf.      *
+ * return number of bytes read          *
+ *        -1 no such file               *
+ *        -5 corrupted data             *
+ ***************************************/
+static int32_t readFile (char *name, char *buf, int32_t len) {
+	int64_t num = pathLookup (currDir, FT_DIR);
+	if (num == -5) {
+		return -5;
+	}
+	assert(num >= 0);
+
+	int64_t nodeNum = geo->lookup (num, name, FT_FIL);
+	if (nodeNum < 0) {
+		return (int32_t)nodeNum;
+	}
+	return readData (getInode (nodeNum), buf, len);
+}//readFile
+
+/****************************************
+ * Turn compression of file name on or  *
+ * off. The content is stored again     *
+ * with the new setting.                *
+ * return as vsfs_write                 *
+ ***************************************/
+static int32_t compressFile (char *name, int8_t on) {
+	char data[fileMaxSize ()];
+
+	int64_t num = pathLookup (currDir, FT_DIR);
+	if (num == -5) {
+		return -5;
+	}
+	assert(num >= 0);
+
+	int64_t nodeNum = geo->lookup (num, name, FT_FIL);
+	if (nodeNum < 0) {
+		return (int32_t)nodeNum;
+	}
+	Inode_t *node = getInode (nodeNum);
+	int32_t len = readData (node, data, sizeof (data));
+	if (len < 0) {
+		return len;
+	}
+
+	int8_t oldFlags = node->flags;
+	int64_t before = subtreeOwnBlocks (node);
+	if (on) {
+		node->flags |= IN_COMPRESS;
+	} else {
+		node->flags &= ~IN_COMPRESS;
+	}
+	int32_t retVal = writeData (node, data, len);
+	if (retVal != 0) {
+		// Content did not change
+		node->flags = oldFlags;
+	}
+	subtreeAdd (num, 0, subtreeOwnBlocks (node) - before);
+	return retVal;
+}//compressFile
 
 /****************************************
  * remove directory in the current      *
  * directory based on file name.        *
  * Directory must be empty.             *
  ***************************************/
-int32_t vsfs_RMD (char *name){
-	SuperBlock_t *block = (SuperBlock_t*)disk;
+static int32_t removeDir (char *name){
 
-	int32_t num = getInodeNbFromPath(currDir, FT_DIR);
+	int64_t num = pathLookup (currDir, FT_DIR);
+	if (num == -5) {
+		return -5;
+	}
 	assert(num >= 0);
+	if (checkDir (num) != 0) {
+		return -5;
+	}
 
-	int32_t nodeNum = getInodeNbFromParent(num, name, FT_DIR);
-	if (nodeNum == -1){
-		return -1;
+	int64_t nodeNum = geo->lookup (num, name, FT_DIR);
+	if (nodeNum < 0){
+		return (int32_t)nodeNum;
     }
-
-	// Make sure directory is empty
-	if (getFileCnt(nodeNum) != 0) {
-		return -1;
+	if (checkDir (nodeNum) != 0) {
+		return -5;
 	}
 
+	// Make sure directory is empty (its aggregates tell without a scan)
 	Inode_t *iNode = getInode(nodeNum);
+	if (iNode->subEntries != 0) {
+		return -1;
+	}
+	int64_t blocks = iNode->subBlocks;
 
-    void *mem;
 	for(int32_t i=0; i<parameters.directCnt; ++i){
-		int32_t numB = iNode->ptr[i];
-		if(numB != -1) {
-			mem = (int8_t *) (disk + block->blockSize + block->blockSize*block->iNodeBMSize);
-            // Clear the data block
-			resetBitInBB (mem, numB);
-			void *data = (void*) getDataBlock(numB);
-			memset(data, 0, block->blockSize);
+		int64_t numB = iNode->ptr[i];
+		if(numB != -1 && dedupUnref (numB) == 0) {
+            // Queue the data block for clearing
+			reclaimBlock (numB);
 		}
 	}
 
@@ -432,31 +977,149 @@ int32_t vsfs_RMD (char *name){
 	Inode_t *upper = getInode (num);
 	assert(upper->type == FT_DIR);
 
-	for(int32_t i=0; i<DIRECTCNT; ++i) {
+	for(int32_t i=0; i<DIRECTCNT && result == -1; ++i) {
 		if(upper->ptr[i] == -1) {
-			result = -1;
-    }
+			break;
+		}
 
 		DirEntry_t *curr = (DirEntry_t*) getDataBlock(upper->ptr[i]);
 		assert(curr != NULL);
 
-		while (curr->next != NULL) {
+		while (curr != NULL) {
 			if (curr->iNodeNb == nodeNum) {
 				curr->iNodeNb = -1;
+				csumUpdate (curr, sizeof (DirEntry_t));
 				result = 0;
+				break;
 			}
 			curr = curr->next;
 		}
 	}
 
 	if (result != -1) {
-		mem = (int8_t *) (disk + block->blockSize);
-		resetBitInBB(mem, nodeNum);
+		iNodeFree (nodeNum);
+		subtreeAdd (num, -1, -blocks);
+		subtreeDepthRemove (num, 1);			// an empty directory, like a file, is one level
 	}
 
 	return result;
+}//removeDir
+
+/*************************************************
+ * File system usage, read from the counters the *
+ * allocators keep in the superblock (O(1)).     *
+ * Blocks of the checksum table count as used.   *
+ ************************************************/
+static void fsUsage (StatFs_t *st) {
+	assert(disk != NULL);
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+
+	st->blockSize = sb->blockSize;
+	st->blocks = sb->blockCnt - 1 - sb->iNodeBMSize - sb->dataBMSize - sb->iNodeTabSize;
+	st->freeBlocks = sb->freeDataCnt;
+	st->usedBlocks = st->blocks - st->freeBlocks;
+	st->iNodes = sb->iNodeTabSize * sb->blockSize / sb->iNodeSize;
+	st->freeINodes = sb->freeINodeCnt;
+	st->usedINodes = st->iNodes - st->freeINodes;
+	int64_t zeroed, discarded;
+	reclaimStats (&st->pendingBlocks, &zeroed, &discarded);
+}//fsUsage
+
+/*************************************************
+ * API entry points. Each one runs the operation *
+ * above and hands its arguments, result and     *
+ * start time to the trace recorder (a no-op     *
+ * unless a trace is being recorded). Updates    *
+ * are bracketed for readers of a shared disk    *
+ * (a no-op unless running with -shm).           *
+ ************************************************/
+int32_t vsfs_create (char *name, int8_t ft) {
+	int64_t t0 = traceBegin ();
+	shmWriteBegin ();
+	int32_t retVal = create (name, ft);
+	shmWriteEnd ();
+	traceEnd (TR_CREATE, name, ft, NULL, 0, retVal, t0);
+	return retVal;
+}//vsfs_create
+
+void vsfs_CD (char *dirName) {
+	int64_t t0 = traceBegin ();
+	changeDir (dirName);
+	traceEnd (TR_CD, dirName, 0, NULL, 0, 0, t0);
+}//vsfs_CD
+
+int32_t vsfs_openDir (char *path, DirCursor_t *cursor) {
+	int64_t t0 = traceBegin ();
+	int32_t retVal = openDir (path, cursor);
+	traceEnd (TR_LOOKUP, path, FT_DIR, NULL, 0, retVal, t0);
+	return retVal;
+}//vsfs_openDir
+
+void vsfs_LS () {
+	int64_t t0 = traceBegin ();
+	listDir ();
+	traceEnd (TR_LS, NULL, 0, NULL, 0, 0, t0);
+}
+
+int32_t vsfs_readDir (DirCursor_t *cursor, Dirent_t *buf, int32_t cnt) {
+	int64_t t0 = traceBegin ();
+	DirCursor_t at = *cursor;
+	int32_t retVal = dirRead (cursor, buf, cnt);
+	traceReadDir (&at, cnt, retVal, t0);
+	return retVal;
+}
+
+void vsfs_statfs (StatFs_t *st) {
+	int64_t t0 = traceBegin ();
+	fsUsage (st);
+	// The free block count shows where a replay's usage drifts
+	traceEnd (TR_STATFS, NULL, 0, NULL, 0, (int32_t)st->freeBlocks, t0);
+}//vsfs_LS
+
+int32_t vsfs_RMF (char *name) {
+	int64_t t0 = traceBegin ();
+	shmWriteBegin ();
+	int32_t retVal = removeFile (name);
+	shmWriteEnd ();
+	traceEnd (TR_RMF, name, FT_FIL, NULL, 0, retVal, t0);
+	return retVal;
+}//vsfs_RMF
+
+int32_t vsfs_RMD (char *name) {
+	int64_t t0 = traceBegin ();
+	shmWriteBegin ();
+	int32_t retVal = removeDir (name);
+	shmWriteEnd ();
+	traceEnd (TR_RMD, name, FT_DIR, NULL, 0, retVal, t0);
+	return retVal;
 }//vsfs_RMD
 
+int32_t vsfs_write (char *name, char *buf, int32_t len) {
+	int64_t t0 = traceBegin ();
+	shmWriteBegin ();
+	int32_t retVal = writeFile (name, buf, len);
+	shmWriteEnd ();
+	traceEnd (TR_WRITE, name, FT_FIL, buf, len, retVal, t0);
+	return retVal;
+}//vsfs_write
+
+int32_t vsfs_read (char *name, char *buf, int32_t len) {
+	int64_t t0 = traceBegin ();
+	int32_t retVal = readFile (name, buf, len);
+	// Only the requested length is recorded, not the data
+	traceEnd (TR_READ, name, FT_FIL, NULL, len, retVal, t0);
+	return retVal;
+}//vsfs_read
+
+int32_t vsfs_compress (char *name, int8_t on) {
+	int64_t t0 = traceBegin ();
+	shmWriteBegin ();
+	int32_t retVal = compressFile (name, on);
+	shmWriteEnd ();
+	traceEnd (TR_COMPRESS, name, on, NULL, 0, retVal, t0);
+	return retVal;
+}//vsfs_compress
+
 /*******************************************
  * get the corresponding symbol from the   *
  * command (such that we can use a switch) *
@@ -487,26 +1150,67 @@ void help (){
 	printf ("dpi x\t\tdump block #x in inodes table\n");
 	printf ("dpbl x\t\tdump block #x in data blocks\n");
 	printf ("dpbld x\t\tdump block #x (seen as directory) in data blocks\n");
+	printf ("df\t\tdisplay free blocks, iNodes and fragmentation\n");
+	printf ("write xxx text\treplace content of file xxx by text\n");
+	printf ("cat xxx\t\tdisplay content of file xxx\n");
+	printf ("zip xxx\t\tcompress file xxx\n");
+	printf ("unzip xxx\tstore file xxx uncompressed\n");
+	printf ("dedup\t\tshare identical data blocks and display statistics\n");
+	printf ("fsck\t\tverify the checksum of every block\n");
+	printf ("du [xxx]\tdisplay entries, blocks and depth below directory xxx (default: current)\n");
+	printf ("find pat [f|d]\tlist files (f) or directories (d) below the current one matching pat\n");
+	printf ("iostat\t\tdisplay I/O counters of the simulated device\n");
 } // help
 
+/**************************************************
+ * Display block and iNode usage (superblock      *
+ * counters) and fragmentation (free-extent       *
+ * index): no bit map scan.                       *
+ * Fragmentation is the share of free blocks that *
+ * lie outside the largest free extent.           *
+ *************************************************/
+void df () {
+	StatFs_t st;
+	int64_t total, freeBlocks, extents, largest;
+	vsfs_statfs (&st);
+	extentStats (&total, &freeBlocks, &extents, &largest);
+
+	int32_t frag = (st.freeBlocks == 0) ? 0 : (int32_t)(100 - (100 * largest) / st.freeBlocks);
+	printf ("data blocks: %lld total, %lld used, %lld free (%d bytes each)\n",
+		(long long)st.blocks, (long long)st.usedBlocks, (long long)st.freeBlocks, st.blockSize);
+	printf ("iNodes: %lld total, %lld used, %lld free\n",
+		(long long)st.iNodes, (long long)st.usedINodes, (long long)st.freeINodes);
+	printf ("free extents: %lld, largest %lld blocks, fragmentation %d%%\n",
+		(long long)extents, (long long)largest, frag);
+	int64_t pending, zeroed, discarded;
+	reclaimStats (&pending, &zeroed, &discarded);
+	printf ("reclaim: %lld blocks queued, %lld zeroed, %lld discarded\n",
+		(long long)pending, (long long)zeroed, (long long)discarded);
+} // df
+
 /******************************************************
  * Command line has 2 elements:                       *
  * a command followed by a parameter to the command.  *
  * get them and call appropriate routine.             *
  * Need to duplicate the command to use getToken which*
- * jeopardizes the string being parsed.               *
+ * jeopardizes the string being parsed. The copy lives*
+ * on the stack: no heap allocation per command.      *
  *****************************************************/
 int parseAndExecute (char *cmdLine) {
 	int quit = 0;
 	int32_t retVal;
 
-	char *dupCmdLine = malloc ((1 + CMDE_LENGTH) * sizeof (char));
-	assert (dupCmdLine != NULL);
-
+	char dupCmdLine[CMDE_LENGTH + 1];
+	if (strlen (cmdLine) > CMDE_LENGTH) {
+		printf ("command too long (max %d chars)\n", CMDE_LENGTH);
+		return 0;
+	}
 	strcpy (dupCmdLine, cmdLine);
+	char *rest = dupCmdLine;
 
-	char *cmde = getToken (&dupCmdLine, ' ');
-	char *param = getToken (&dupCmdLine, ' ');
+	char *cmde = getToken (&rest, ' ');
+	char *param = getToken (&rest, ' ');
+	char data[fileMaxSize ()];
 
 	if (cmde == NULL) {
 		printf ("command %s not found\n", cmdLine);
@@ -594,32 +1298,111 @@ int parseAndExecute (char *cmdLine) {
 				if (param == NULL) {
 					printf ("%s: missing operand\n", cmdLine);
 				} else {
-					dumpInode (atoi(param));
+					dumpInode (atoll(param));
 				}
 				break;
 		case DUMPBLOCK:
 				if (param == NULL) {
 					printf ("%s: missing operand\n", cmdLine);
 				} else {
-					dumpDataBlock (atoi(param));
+					dumpDataBlock (atoll(param));
 				}
 				break;
 		case DUMPBLOCKDIR:
 				if (param == NULL) {
 					printf ("%s: missing operand\n", cmdLine);
 				} else {
-					dumpDataDirBlock (atoi(param));
+					dumpDataDirBlock (atoll(param));
 				}
 				break;
+		case DF:
+				if (param != NULL) {
+					printf ("%s: bad operand\n", param);
+				} else {
+					df ();
+				}
+				break;
+		case WRITE:
+				if (param == NULL) {
+					printf ("%s: missing operand\n", cmdLine);
+				} else {
+					// Text is the rest of the line
+					retVal = vsfs_write (param, rest, (rest == NULL) ? 0 : strlen (rest));
+					if (retVal != 0)
+						printf ("Error %d in writing %s\n", retVal, param);
+				}
+				break;
+		case CAT:
+				if (param == NULL) {
+					printf ("%s: missing operand\n", cmdLine);
+				} else {
+					retVal = vsfs_read (param, data, sizeof (data));
+					if (retVal < 0)
+						printf ("Error %d in reading %s\n", retVal, param);
+					else
+						printf ("%.*s\n", retVal, data);
+				}
+				break;
+		case ZIP:
+		case UNZIP:
+				if (param == NULL) {
+					printf ("%s: missing operand\n", cmdLine);
+				} else {
+					retVal = vsfs_compress (param, getCmd (cmde) == ZIP);
+					if (retVal != 0)
+						printf ("Error %d in compressing %s\n", retVal, param);
+				}
+				break;
+		case DEDUP:
+				if (param != NULL) {
+					printf ("%s: bad operand\n", param);
+				} else {
+					shmWriteBegin ();
+					int64_t freed = dedupScan ();
+					shmWriteEnd ();
+					int64_t refs, physical, shared;
+					dedupStats (&refs, &physical, &shared);
+					printf ("dedup: %lld blocks freed\n", (long long)freed);
+					printf ("file blocks: %lld referenced, %lld stored, %lld shared, %lld saved\n",
+						(long long)refs, (long long)physical, (long long)shared, (long long)(refs - physical));
+				}
+				break;
+		case FSCK:
+				if (param != NULL) {
+					printf ("%s: bad operand\n", param);
+				} else {
+					int64_t firstBad;
+					int32_t threadCnt = (int32_t)sysconf (_SC_NPROCESSORS_ONLN);
+					int64_t bad = csumVerifyAll (threadCnt, &firstBad);
+					printf ("fsck: %lld corrupted blocks", (long long)bad);
+					if (bad != 0)
+						printf (" (first: block %lld)", (long long)firstBad);
+					printf (", crc32c %s\n", crc32cHardware () ? "hardware" : "software");
+				}
+				break;
+		case DU:
+				du (param);
+				break;
+		case FIND:
+				if (param == NULL) {
+					printf ("%s: missing operand\n", cmdLine);
+				} else if (rest != NULL && rest[0] != 0 && strcmp (rest, "f") != 0 && strcmp (rest, "d") != 0) {
+					printf ("%s: bad operand\n", rest);
+				} else {
+					find (param, (rest == NULL || rest[0] == 0) ? 0 : (rest[0] == 'f') ? FT_FIL : FT_DIR);
+				}
+				break;
+		case IOSTAT:
+				devReport ();
+				break;
 		case BADCMDE:
 				printf ("command %s not found\n", cmdLine);
 	}
-	//free (dupCmdLine);
 	return quit;
 
 }//parseAndExecute
 
-int main () {
+int main (int argc, char **argv) {
 	int32_t retVal;
 	char *cmdLine = NULL;			// Command line for our shell
 	size_t len = 0;					// Number of char read for our shell
@@ -628,20 +1411,128 @@ int main () {
 	parameters.blockSize = BLOCKSIZE;
 	parameters.iNodeBMSize = INODEBMSIZE;
 	parameters.dataBMSize = DATABMSIZE;
-	parameters.iNodeTabSize = INODETABSIZE;
 	parameters.directCnt = DIRECTCNT;
+	parameters.compress = FALSE;
 	paramDebug = FALSE;
 
-	// Set disk ang go !
-	currDir = (char *)(malloc (PATH_MAXLEN*sizeof(char)));
-	assert (currDir != NULL);
+	// -z: compress new files
+	// -b n: block size in bytes
+	// -soak n: run n mixed operations and report memory usage
+	// -bench n: compare generic and specialised geometry code
+	// -trace file: record every API call to file
+	// -replay file [-paced]: run a recorded trace and report latencies
+	// -n n: number of blocks on the disk
+	// -shm name: put the disk in shared memory object name (single writer)
+	// -attach name [-bench n [-procs p]]: read-only access to a shared disk
+	// -dev spec: simulated storage device (e.g. hdd, ssd,qd=4,fault=1000)
+	int64_t blockCnt = 100;
+	int64_t soakCnt = 0;
+	int64_t benchCnt = 0;
+	char *tracePath = NULL;
+	char *replayPath = NULL;
+	int8_t paced = FALSE;
+	char *shmName = NULL;
+	char *attachName = NULL;
+	int32_t procCnt = 1;
+	char *devSpec = NULL;
+	for (int i=1; i<argc; i++) {
+		if (strcmp (argv[i], "-z") == 0) {
+			parameters.compress = TRUE;
+		} else if (strcmp (argv[i], "-b") == 0 && i + 1 < argc) {
+			parameters.blockSize = atoi (argv[++i]);
+		} else if (strcmp (argv[i], "-soak") == 0 && i + 1 < argc) {
+			soakCnt = atoll (argv[++i]);
+		} else if (strcmp (argv[i], "-bench") == 0 && i + 1 < argc) {
+			benchCnt = atoll (argv[++i]);
+		} else if (strcmp (argv[i], "-trace") == 0 && i + 1 < argc) {
+			tracePath = argv[++i];
+		} else if (strcmp (argv[i], "-replay") == 0 && i + 1 < argc) {
+			replayPath = argv[++i];
+		} else if (strcmp (argv[i], "-paced") == 0) {
+			paced = TRUE;
+		} else if (strcmp (argv[i], "-n") == 0 && i + 1 < argc) {
+			blockCnt = atoll (argv[++i]);
+		} else if (strcmp (argv[i], "-shm") == 0 && i + 1 < argc) {
+			shmName = argv[++i];
+		} else if (strcmp (argv[i], "-attach") == 0 && i + 1 < argc) {
+			attachName = argv[++i];
+		} else if (strcmp (argv[i], "-procs") == 0 && i + 1 < argc) {
+			procCnt = atoi (argv[++i]);
+		} else if (strcmp (argv[i], "-dev") == 0 && i + 1 < argc) {
+			devSpec = argv[++i];
+		} else {
+			printf ("usage: %s [-z] [-b blocksize] [-n blocks] [-soak n] [-bench n] [-trace file] [-replay file [-paced]] [-shm name] [-dev spec]\n", argv[0]);
+			printf ("       %s -attach name [-bench n [-procs p]]\n", argv[0]);
+			return 1;
+		}
+	}
+	// A reader only maps the disk of a running writer
+	if (attachName != NULL) {
+		if (shmAttach (attachName) != 0) {
+			return 1;
+		}
+		shmReader (benchCnt, procCnt);
+		shmRelease ();
+		return 0;
+	}
+	// A replay formats the disk the trace was recorded on
+	if (replayPath != NULL && traceLoad (replayPath, &blockCnt) != 0) {
+		return 1;
+	}
+	if (parameters.blockSize < 2 * (int)sizeof (DirEntry_t)
+	|| parameters.blockSize < (int)sizeof (SuperBlock_t)) {
+		printf ("block size must be at least %d bytes\n",
+			(2 * sizeof (DirEntry_t) > sizeof (SuperBlock_t)) ? 2 * (int)sizeof (DirEntry_t) : (int)sizeof (SuperBlock_t));
+		return 1;
+	}
+	// The default iNode table holds INODECNT iNodes whatever their size
+	parameters.iNodeTabSize = (INODECNT * (int)sizeof (Inode_t) + parameters.blockSize - 1) / parameters.blockSize;
+	if (blockCnt <= 0 || blockCnt < diskMinBlocks ()) {
+		printf ("usage: -n blocks: at least %lld blocks of %d bytes (metadata, checksums and one data block)\n",
+			(long long)diskMinBlocks (), parameters.blockSize);
+		return 1;
+	}
 
-	vsfs_initDisk (100);
+	// Set disk ang go !
+	if (shmName != NULL && shmCreate (shmName, (int64_t)parameters.blockSize * blockCnt) != 0) {
+		return 1;
+	}
+	vsfs_initDisk (blockCnt);
 	vsfs_mount ();
+	// Format and mount are not charged to the device
+	if (devSpec != NULL && devStart (devSpec) != 0) {
+		return 1;
+	}
+	if (tracePath != NULL && traceStart (tracePath) != 0) {
+		return 1;
+	}
+
+	if (soakCnt != 0 || benchCnt != 0 || replayPath != NULL) {
+		if (replayPath != NULL)
+			traceReplay (paced);
+		if (soakCnt != 0)
+			soak (soakCnt);
+		if (benchCnt != 0)
+			geometryBench (benchCnt);
+		if (devSpec != NULL)
+			devReport ();
+		traceStop ();
+		reclaimRelease ();
+		csumRelease ();
+		dedupRelease ();
+		extentRelease ();
+		free (currDir);
+		if (shmShared ()) {
+			shmRelease ();
+		} else {
+			free (disk);
+		}
+		return 0;
+	}
 	printf ("%s: ", currDir);
 
 	cmdLine = malloc (CMDE_LENGTH * sizeof (char));
-	assert (currDir != NULL);
+	assert (cmdLine != NULL);
 
 	retVal = getline (&cmdLine, &len, stdin);
 	while ( retVal != -1) {
@@ -652,6 +1543,16 @@ int main () {
   		retVal = getline (&cmdLine, &len, stdin);
 	}
 	free (cmdLine);
-	free (disk);
+	traceStop ();
+	reclaimRelease ();
+	csumRelease ();
+	dedupRelease ();
+	extentRelease ();
+	free (currDir);
+	if (shmShared ()) {
+		shmRelease ();
+	} else {
+		free (disk);
+	}
 	return 0;
 }//main
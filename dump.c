@@ -11,7 +11,7 @@
 extern char *currDir;
 extern void *disk;
 
-void breakAddress (void *address, int32_t *blockNb, int32_t *offset) {
+void breakAddress (void *address, int64_t *blockNb, int32_t *offset) {
 	SuperBlock_t *sb = disk;
 	int blockSize = sb->blockSize;  
 	*blockNb = (address - disk) / blockSize;
@@ -27,21 +27,27 @@ void dumpDisk () {
 	printf ("==== Dump Disk ====\n");
 	printf (" Superblock:\n");
 	printf ("\tsignature:%08x", sb->signature);
-	printf ("\t\tblock count:%d", sb->blockCnt);
+	printf ("\tversion: %d", sb->version);
+	printf ("\t\tblock count:%lld", (long long)sb->blockCnt);
 	printf ("\t\t\tblock size (bytes): %d\n", sb->blockSize);
-	printf ("\tiNode BM size (blocks): %d", sb->iNodeBMSize);
-	printf ("\tdata BM size (blocks): %d", sb->dataBMSize);
-	printf ("\tiNode table size (blocks): %d\n", sb->iNodeSize);
+	printf ("\tiNode BM size (blocks): %lld", (long long)sb->iNodeBMSize);
+	printf ("\tdata BM size (blocks): %lld", (long long)sb->dataBMSize);
+	printf ("\tiNode table size (blocks): %lld\n", (long long)sb->iNodeTabSize);
+	printf ("\tfree iNodes: %lld", (long long)sb->freeINodeCnt);
+	printf ("\t\tfree data blocks: %lld\n", (long long)sb->freeDataCnt);
+	printf ("\tflags: %02x%s", sb->flags, (sb->flags & SB_COMPRESS) ? " (compressed files)" : "");
+	printf ("\tgeometry profile: %s\n", geo->name);
 	printf ("===================\n");
 }
 
 /*******************************
  * Dump data block normal file *
  ******************************/
-void dumpDataBlock (int32_t blockNb) {
+void dumpDataBlock (int64_t blockNb) {
 	int i;
 	char ascii[17];
-	int32_t block, offset;
+	int64_t block;
+	int32_t offset;
 	assert (disk != NULL);
 	SuperBlock_t *sb = disk;
 
@@ -49,7 +55,7 @@ void dumpDataBlock (int32_t blockNb) {
 	unsigned char *ptr = (unsigned char *) add; 
 	breakAddress (add, &block, &offset);
 	printf ("==== Dump Data Block ====\n");
-	printf ("\tDataBlock #[%d] - Address: |%p| = block %d offset %d First byte: %02x\n", blockNb, add, block, offset, ptr[0]);
+	printf ("\tDataBlock #[%lld] - Address: |%p| = block %lld offset %d First byte: %02x\n", (long long)blockNb, add, (long long)block, offset, ptr[0]);
 	
 	// process every byte 
 	for (i=0; i<sb->blockSize; i++) {
@@ -85,21 +91,22 @@ void dumpDataBlock (int32_t blockNb) {
 /***********************************
  * Dump data block of a directory. *
  **********************************/
-void dumpDataDirBlock (int32_t blockNb) {
-	int32_t block, offset;
+void dumpDataDirBlock (int64_t blockNb) {
+	int64_t block;
+	int32_t offset;
 	assert (disk != NULL);
 
 	DirEntry_t *add = (DirEntry_t *) getDataBlock (blockNb);
 	breakAddress (add, &block, &offset);
 	printf ("==== Dump Directory Data Block ====\n");
-	printf ("\tDataDirBlock #[%d] - Address: |%p| = block %d offset %d First word: %08x\n", blockNb, add, block, offset, *(int8_t *) add);
+	printf ("\tDataDirBlock #[%lld] - Address: |%p| = block %lld offset %d First word: %08x\n", (long long)blockNb, add, (long long)block, offset, *(int8_t *) add);
 
 	int iCnt = 0;
 	while (add != NULL) {
-		printf ("\tEntry #%d iNode: %d name: %.15s next: %p", iCnt, add->iNodeNb, add->fileName, add->next);
+		printf ("\tEntry #%d iNode: %lld name: %.15s next: %p", iCnt, (long long)add->iNodeNb, add->fileName, add->next);
 		if (add->next != NULL) {
 			breakAddress (add->next, &block, &offset);
-			printf (" = block %d offset %d", block, offset);
+			printf (" = block %lld offset %d", (long long)block, offset);
 		}
 		printf ("\n");
 		add = add->next;
@@ -111,23 +118,28 @@ void dumpDataDirBlock (int32_t blockNb) {
 /********************************
  * Dump iNode given its number. *
  *******************************/
-void dumpInode (int32_t iNodeNb) {
-	int32_t block, offset;		// for debug
+void dumpInode (int64_t iNodeNb) {
+	int64_t block;					// for debug
+	int32_t offset;
 	assert (disk != NULL);
 	// SuperBlock_t *sb = disk;
 	Inode_t *iNode = getInode (iNodeNb);
 
 	breakAddress(iNode, &block, &offset);
-	printf("iNode #[%d] - Address: |%p| = block %d offset %d\n", iNodeNb, iNode, block, offset);
+	printf("iNode #[%lld] - Address: |%p| = block %lld offset %d\n", (long long)iNodeNb, iNode, (long long)block, offset);
 
-	printf("\tNumber: %d\tType: %d\t", iNode->number, iNode->type);
+	printf("\tNumber: %lld\tType: %d\t", (long long)iNode->number, iNode->type);
 	if (iNode->type == FT_DIR) {
 		printf (" (directory)\n");
+		printf ("\tBelow: %lld entries\t%lld blocks\tdepth %d\n", (long long)iNode->subEntries,
+			(long long)iNode->subBlocks, iNode->subDepth);
 	} else {
 		printf (" (not a directory)\n");
+		printf ("\tSize: %lld\tStored: %lld\tFlags: %02x%s\n", (long long)iNode->size, (long long)iNode->storedSize,
+			iNode->flags, (iNode->flags & IN_ZDATA) ? " (compressed)" : "");
 	}
 	for (int i = 0; i<DIRECTCNT; i++) {
-		printf ("\tptr[%d]: %d", i, iNode->ptr[i]);
+		printf ("\tptr[%d]: %lld", i, (long long)iNode->ptr[i]);
 	}
 	printf ("\n");
 }
@@ -0,0 +1,354 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "vsfs.h"
+#include "library.h"
+
+extern void *disk;
+
+/*************************************************************
+ * Free-extent index of the data blocks.                     *
+ * Every run of free blocks in the data bit map is an extent *
+ * kept in a list of size bucket k (2^k <= len < 2^(k+1)).   *
+ * headAt/tailAt give the extent starting/ending at a block, *
+ * so a freed range merges with its neighbours in O(1).      *
+ * The index lives in memory only: it is rebuilt from the    *
+ * bit map at mount and every change is applied to both.     *
+ ************************************************************/
+#define EXT_BUCKETS		64
+
+typedef struct Extent {
+	int64_t start;				// first free data block
+	int64_t len;					// number of free blocks
+	int64_t prev;					// previous extent in size bucket. -1 at head
+	int64_t next;					// next extent in size bucket or in pool. -1 at end
+} Extent_t;
+
+static Extent_t *ext = NULL;			// extent pool
+static int64_t poolHead = -1;			// unused entries of the pool
+static int64_t *headAt = NULL;		// extent starting at block b, -1 if none
+static int64_t *tailAt = NULL;		// extent ending at block b, -1 if none
+static int64_t bucket[EXT_BUCKETS];
+static int64_t dataCnt = 0;				// data blocks covered by the index
+static int64_t freeBlkCnt = 0;		// free data blocks
+static int64_t extCnt = 0;				// free extents
+
+static int8_t *getDataBM () {
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	return (int8_t *) (disk + sb->blockSize + sb->blockSize*sb->iNodeBMSize);
+}
+
+static int bucketOf (int64_t len) {
+	return 63 - __builtin_clzll ((uint64_t)len);
+}
+
+// Set (val = 1) or clear (val = 0) cnt bits of bm from bit start.
+static void setBits (int8_t *bm, int64_t start, int64_t cnt, int val) {
+	int64_t b = start;
+	int64_t end = start + cnt;
+	for (; b < end && (b % 8) != 0; b++) {
+		if (val) bm[b/8] |= (1 << (b%8)); else bm[b/8] &= ~(1 << (b%8));
+	}
+	if (end - b >= 8) {
+		memset (bm + b/8, val ? 0xff : 0, (end - b) / 8);
+		b += ((end - b) / 8) * 8;
+	}
+	for (; b < end; b++) {
+		if (val) bm[b/8] |= (1 << (b%8)); else bm[b/8] &= ~(1 << (b%8));
+	}
+	csumUpdate (bm + start/8, (end - 1)/8 - start/8 + 1);
+}
+
+// Keep the superblock count of free data blocks in step
+static void usedDataAdd (int64_t cnt) {
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	sb->freeDataCnt -= cnt;
+	csumUpdate (sb, sizeof (SuperBlock_t));
+}
+
+static void insertExtent (int64_t start, int64_t len) {
+	assert (poolHead != -1);
+	int64_t id = poolHead;
+	poolHead = ext[id].next;
+
+	int k = bucketOf (len);
+	ext[id].start = start;
+	ext[id].len = len;
+	ext[id].prev = -1;
+	ext[id].next = bucket[k];
+	if (bucket[k] != -1) {
+		ext[bucket[k]].prev = id;
+	}
+	bucket[k] = id;
+
+	headAt[start] = id;
+	tailAt[start + len - 1] = id;
+	freeBlkCnt += len;
+	extCnt++;
+}
+
+static void removeExtent (int64_t id) {
+	Extent_t *e = &ext[id];
+	if (e->prev != -1) {
+		ext[e->prev].next = e->next;
+	} else {
+		bucket[bucketOf (e->len)] = e->next;
+	}
+	if (e->next != -1) {
+		ext[e->next].prev = e->prev;
+	}
+
+	headAt[e->start] = -1;
+	tailAt[e->start + e->len - 1] = -1;
+	freeBlkCnt -= e->len;
+	extCnt--;
+
+	e->next = poolHead;
+	poolHead = id;
+}
+
+// Allocate the first cnt blocks of extent id
+static int64_t carveExtent (int64_t id, int64_t cnt) {
+	int64_t start = ext[id].start;
+	int64_t len = ext[id].len;
+	removeExtent (id);
+	if (len > cnt) {
+		insertExtent (start + cnt, len - cnt);
+	}
+	setBits (getDataBM (), start, cnt, 1);
+	usedDataAdd (cnt);
+	return start;
+}
+
+/************************************************
+ * Release the index (called before unmounting) *
+ ***********************************************/
+void extentRelease () {
+	free (ext);
+	free (headAt);
+	free (tailAt);
+	ext = NULL;
+	headAt = tailAt = NULL;
+	dataCnt = freeBlkCnt = extCnt = 0;
+}//extentRelease
+
+/**********************************************
+ * Rebuild the index from the data bit map.   *
+ * Whole words of used or free blocks inside  *
+ * a run are skipped.                         *
+ *********************************************/
+void extentBuild () {
+	assert (disk != NULL);
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+
+	extentRelease ();
+	dataCnt = sb->blockCnt - 1 - sb->iNodeBMSize - sb->dataBMSize - sb->iNodeTabSize;
+	if (dataCnt > sb->dataBMSize * sb->blockSize * 8) {
+		dataCnt = sb->dataBMSize * sb->blockSize * 8;
+	}
+	assert (dataCnt > 0);
+
+	// At most one extent every other block
+	int64_t poolSize = dataCnt / 2 + 1;
+	ext = malloc (poolSize * sizeof (Extent_t));
+	headAt = malloc (dataCnt * sizeof (int64_t));
+	tailAt = malloc (dataCnt * sizeof (int64_t));
+	assert (ext != NULL && headAt != NULL && tailAt != NULL);
+
+	for (int64_t i=0; i<poolSize; i++) {
+		ext[i].next = (i + 1 < poolSize) ? i + 1 : -1;
+	}
+	poolHead = 0;
+	for (int64_t i=0; i<dataCnt; i++) {
+		headAt[i] = tailAt[i] = -1;
+	}
+	for (int k=0; k<EXT_BUCKETS; k++) {
+		bucket[k] = -1;
+	}
+
+	uint8_t *bm = (uint8_t *) getDataBM ();
+	int64_t runStart = -1;
+	int64_t b = 0;
+	while (b < dataCnt) {
+		// Skip 64 used (or free) blocks at once inside a long run
+		if ((b % 64) == 0 && b + 64 <= dataCnt) {
+			uint64_t w;
+			memcpy (&w, bm + b/8, 8);
+			if ((runStart == -1 && w == UINT64_MAX) || (runStart != -1 && w == 0)) {
+				b += 64;
+				continue;
+			}
+		}
+		int used = (bm[b/8] & (1 << (b%8))) != 0;
+		if (!used && runStart == -1) {
+			runStart = b;
+		} else if (used && runStart != -1) {
+			insertExtent (runStart, b - runStart);
+			runStart = -1;
+		}
+		b++;
+	}
+	if (runStart != -1) {
+		insertExtent (runStart, dataCnt - runStart);
+	}
+	// The bit map and the superblock counters must agree
+	assert (sb->freeDataCnt == freeBlkCnt);
+}//extentBuild
+
+// Merge the free range [start, start + cnt) with the free extents
+// around it (bit map and counters are the caller's business)
+static void mergeFree (int64_t start, int64_t cnt) {
+	int64_t s = start;
+	int64_t len = cnt;
+	if (start > 0 && tailAt[start - 1] != -1) {
+		int64_t left = tailAt[start - 1];
+		s = ext[left].start;
+		len += ext[left].len;
+		removeExtent (left);
+	}
+	if (start + cnt < dataCnt && headAt[start + cnt] != -1) {
+		int64_t right = headAt[start + cnt];
+		len += ext[right].len;
+		removeExtent (right);
+	}
+	insertExtent (s, len);
+}
+
+// Best fit in the size bucket of cnt, else the first extent of the
+// next non-empty bucket. -1 if no extent is large enough
+static int64_t allocFit (int64_t cnt) {
+	if (cnt <= 0 || cnt > freeBlkCnt) {
+		return -1;
+	}
+
+	int64_t best = -1;
+	int k = bucketOf (cnt);
+	for (int64_t id = bucket[k]; id != -1; id = ext[id].next) {
+		if (ext[id].len >= cnt && (best == -1 || ext[id].len < ext[best].len)) {
+			best = id;
+			if (ext[id].len == cnt) {
+				break;
+			}
+		}
+	}
+	for (k++; k < EXT_BUCKETS && best == -1; k++) {
+		best = bucket[k];
+	}
+	if (best == -1) {
+		return -1;
+	}
+	return carveExtent (best, cnt);
+}
+
+/****************************************************
+ * Allocate cnt contiguous data blocks (best fit in *
+ * the size bucket of cnt, else the first extent of *
+ * the next non-empty bucket: every extent there is *
+ * large enough, so no list is walked) and set them *
+ * in the data bit map. Blocks still queued for     *
+ * reclaim are freed first when nothing fits.       *
+ * return the first block number, -1 if no extent   *
+ * is large enough                                  *
+ ***************************************************/
+int64_t extentAlloc (int64_t cnt) {
+	int64_t start = allocFit (cnt);
+	if (start == -1 && reclaimDrain () > 0) {
+		start = allocFit (cnt);
+	}
+	return start;
+}//extentAlloc
+
+/****************************************************
+ * Allocate cnt data blocks starting exactly at     *
+ * block start (used to grow a chain contiguously). *
+ * return start, -1 if those blocks are not free    *
+ ***************************************************/
+int64_t extentAllocAt (int64_t start, int64_t cnt) {
+	if (start < 0 || start >= dataCnt || cnt <= 0) {
+		return -1;
+	}
+	int64_t id = headAt[start];
+	if (id == -1 || ext[id].len < cnt) {
+		return -1;
+	}
+	return carveExtent (id, cnt);
+}//extentAllocAt
+
+/****************************************************
+ * Free cnt data blocks from block start: clear     *
+ * them in the data bit map and merge the range     *
+ * with the free extents around it.                 *
+ ***************************************************/
+void extentFree (int64_t start, int64_t cnt) {
+	assert (start >= 0 && cnt > 0 && start + cnt <= dataCnt);
+	setBits (getDataBM (), start, cnt, 0);
+	usedDataAdd (-cnt);
+	mergeFree (start, cnt);
+}//extentFree
+
+/****************************************************
+ * Free n data blocks given in increasing order.    *
+ * The bit map is cleared one 64-bit word at a time *
+ * (one mask per word) and every run of consecutive *
+ * blocks is merged with the extents around it.     *
+ ***************************************************/
+void extentFreeBatch (const int64_t *blocks, int64_t n) {
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	uint8_t *bm = (uint8_t *) getDataBM ();
+	int64_t bmBytes = sb->dataBMSize * sb->blockSize;
+
+	for (int64_t i=0; i<n; ) {
+		// Clear every block of the batch falling in word w
+		int64_t w = blocks[i] / 64;
+		uint64_t mask = 0;
+		for (; i < n && blocks[i] / 64 == w; i++) {
+			assert (blocks[i] >= 0 && blocks[i] < dataCnt && (i == 0 || blocks[i] > blocks[i-1]));
+			mask |= 1ULL << (blocks[i] % 64);
+		}
+		if (w * 8 + 8 <= bmBytes) {
+			uint64_t v;
+			memcpy (&v, bm + w*8, 8);
+			assert ((v & mask) == mask);
+			v &= ~mask;
+			memcpy (bm + w*8, &v, 8);
+		} else {
+			for (int64_t k=0; w*8 + k < bmBytes; k++) {
+				bm[w*8 + k] &= ~(uint8_t)(mask >> (8*k));
+			}
+		}
+		csumUpdate (bm + w*8, (w * 8 + 8 <= bmBytes) ? 8 : bmBytes - w*8);
+	}
+	for (int64_t i=0; i<n; ) {
+		int64_t j = i + 1;
+		while (j < n && blocks[j] == blocks[j-1] + 1) {
+			j++;
+		}
+		mergeFree (blocks[i], j - i);
+		i = j;
+	}
+	usedDataAdd (-n);
+}//extentFreeBatch
+
+/****************************************************
+ * Report total and free data blocks, number of     *
+ * free extents and size of the largest one.        *
+ ***************************************************/
+void extentStats (int64_t *total, int64_t *freeBlocks, int64_t *extents, int64_t *largest) {
+	*total = dataCnt;
+	*freeBlocks = freeBlkCnt;
+	*extents = extCnt;
+	*largest = 0;
+	for (int k = EXT_BUCKETS - 1; k >= 0; k--) {
+		if (bucket[k] != -1) {
+			for (int64_t id = bucket[k]; id != -1; id = ext[id].next) {
+				if (ext[id].len > *largest) {
+					*largest = ext[id].len;
+				}
+			}
+			break;
+		}
+	}
+}//extentStats
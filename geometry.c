@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "vsfs.h"
+#include "library.h"
+
+extern void *disk;
+
+/*****************************************************************
+ * Geometry profiles: the hot paths of geometry_tmpl.h (block    *
+ * address math, directory lookup and block hashing) compiled    *
+ * for common (block size, direct pointers) pairs, plus a        *
+ * generic version reading them at runtime.                      *
+ * vsfs_mount selects the profile once through geometrySelect.   *
+ * Where the bit maps and the iNode table start depends on the   *
+ * disk size, not only on its geometry: that offset is computed  *
+ * once at mount (geoFirstData) and shared by every profile.     *
+ ****************************************************************/
+#define GEO_RUNS			5				// bench: best of GEO_RUNS runs
+
+static int64_t geoFirstData = 0;		// first data block on the disk
+static int32_t geoBlockSize = 0;		// runtime values for the generic profile
+static int32_t geoDirectCnt = 0;
+
+/****************************************************
+ * 64-bit hash of a buffer: 8 bytes at a time mixed *
+ * by multiply and xor-shift (not cryptographic).   *
+ * Inline so that a constant len unrolls the loop.  *
+ ***************************************************/
+static inline uint64_t hash64 (const char *data, int32_t len) {
+	const uint64_t k = 0x9e3779b97f4a7c15ULL;
+	uint64_t h = k ^ (uint64_t)len;
+	int32_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint64_t v;
+		memcpy (&v, data + i, 8);
+		h = (h ^ (v * k)) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
+	}
+	for (; i < len; i++) {
+		h = (h ^ (uint8_t)data[i]) * k;
+	}
+	h ^= h >> 29;
+	return h * 0xc4ceb9fe1a85ec53ULL;
+}
+
+uint64_t blockHashOf (const char *data, int32_t len) {
+	return hash64 (data, len);
+}//blockHashOf
+
+#define GEO_BS			geoBlockSize
+#define GEO_DC			geoDirectCnt
+#define GEO_SUFFIX	generic
+#include "geometry_tmpl.h"
+#undef GEO_BS
+#undef GEO_DC
+#undef GEO_SUFFIX
+
+#define GEO_BS			BLOCKSIZE
+#define GEO_DC			DIRECTCNT
+#define GEO_SUFFIX	default
+#include "geometry_tmpl.h"
+#undef GEO_BS
+#undef GEO_DC
+#undef GEO_SUFFIX
+
+#define GEO_BS			512
+#define GEO_DC			DIRECTCNT
+#define GEO_SUFFIX	512
+#include "geometry_tmpl.h"
+#undef GEO_BS
+#undef GEO_DC
+#undef GEO_SUFFIX
+
+#define GEO_BS			4096
+#define GEO_DC			DIRECTCNT
+#define GEO_SUFFIX	4k
+#include "geometry_tmpl.h"
+#undef GEO_BS
+#undef GEO_DC
+#undef GEO_SUFFIX
+
+#define PROFILE(name, bs, dc, sfx)	{name, bs, dc, lookup_##sfx, blockHash_##sfx, \
+	blockOf_##sfx, dataBlock_##sfx}
+
+static const Geometry_t profiles[] = {
+	PROFILE ("generic", 0, 0, generic),
+	PROFILE ("default", BLOCKSIZE, DIRECTCNT, default),
+	PROFILE ("512", 512, DIRECTCNT, 512),
+	PROFILE ("4k", 4096, DIRECTCNT, 4k),
+};
+#define PROFILECNT	(int32_t)(sizeof (profiles) / sizeof (profiles[0]))
+
+const Geometry_t *geo = &profiles[0];
+
+/***************************************************
+ * Pick the profile matching the mounted disk, the *
+ * generic one if none does. Called at mount.      *
+ **************************************************/
+void geometrySelect () {
+	assert (disk != NULL);
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+
+	geoFirstData = 1 + sb->iNodeBMSize + sb->dataBMSize + sb->iNodeTabSize;
+	geoBlockSize = sb->blockSize;
+	geoDirectCnt = parameters.directCnt;
+
+	geo = &profiles[0];
+	for (int32_t i=1; i<PROFILECNT; i++) {
+		if (profiles[i].blockSize == sb->blockSize && profiles[i].directCnt == parameters.directCnt) {
+			geo = &profiles[i];
+			break;
+		}
+	}
+}//geometrySelect
+
+static double elapsedNs (struct timespec *t0, struct timespec *t1) {
+	return (t1->tv_sec - t0->tv_sec) * 1e9 + (t1->tv_nsec - t0->tv_nsec);
+}
+
+#define GEO_TESTCNT		5
+
+// Time n iterations of test t with profile g. return ns per iteration
+static double benchRun (const Geometry_t *g, int32_t t, int64_t n, const char *last) {
+	struct timespec t0, t1;
+	volatile uint64_t sink = 0;
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	const char *block = g->dataBlock (0);
+	int64_t dataCnt = sb->csumStart - geoFirstData;
+
+	clock_gettime (CLOCK_MONOTONIC, &t0);
+	switch (t) {
+		case 0:
+			for (int64_t i=0; i<n; i++) {
+				sink += g->lookup (0, last, FT_FIL);
+			}
+			break;
+		case 1:
+			for (int64_t i=0; i<n; i++) {
+				sink += g->lookup (0, "missing", FT_FIL);
+			}
+			break;
+		case 2:
+			for (int64_t i=0; i<n; i++) {
+				sink += g->blockHash (block);
+			}
+			break;
+		case 3:
+			for (int64_t i=0; i<n; i++) {
+				sink += g->blockOf (block + i % (dataCnt * sb->blockSize));
+			}
+			break;
+		case 4:
+			for (int64_t i=0; i<n; i++) {
+				sink += (uintptr_t)g->dataBlock (i % dataCnt);
+			}
+			break;
+	}
+	clock_gettime (CLOCK_MONOTONIC, &t1);
+	return elapsedNs (&t0, &t1) / n;
+}
+
+/*******************************************************
+ * Time n lookups in a full root directory (last entry *
+ * and a missing name, i.e. a full scan), block hashes *
+ * and address to block and block to address           *
+ * conversions with the generic and the selected       *
+ * profile. Each figure is the best of GEO_RUNS runs,  *
+ * the two profiles taking turns.                      *
+ ******************************************************/
+void geometryBench (int64_t n) {
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	char name[FILENAME_LENGTH + 1];
+	char last[FILENAME_LENGTH + 1] = "";
+
+	// Fill the root directory (as far as free blocks allow)
+	int32_t slots = parameters.directCnt * (sb->blockSize / (int32_t)sizeof (DirEntry_t)) - 1;
+	for (int32_t i=0; i<slots; i++) {
+		int64_t total, freeBlocks, extents, largest;
+		extentStats (&total, &freeBlocks, &extents, &largest);
+		if (freeBlocks < 2) {
+			break;
+		}
+		snprintf (name, sizeof (name), "b%d", i);
+		if (vsfs_create (name, FT_FIL) != 0) {
+			break;
+		}
+		strcpy (last, name);
+	}
+	assert (last[0] != 0);
+
+	printf ("==== Geometry bench: block %d bytes, %d pointers, profile %s ====\n",
+		sb->blockSize, parameters.directCnt, geo->name);
+	if (geo == &profiles[0]) {
+		printf ("no specialised profile for this geometry\n");
+	}
+	// Called through a volatile pointer so that neither profile is inlined
+	const Geometry_t *volatile run[2] = {&profiles[0], geo};
+	const char *test[GEO_TESTCNT] = {"lookup", "miss", "hash", "blockOf", "dataBlock"};
+	for (int32_t t=0; t<GEO_TESTCNT; t++) {
+		double best[2] = {0, 0};
+		for (int32_t k=0; k<GEO_RUNS; k++) {
+			for (int32_t r=0; r<2; r++) {
+				double ns = benchRun (run[r], t, n, last);
+				if (k == 0 || ns < best[r]) {
+					best[r] = ns;
+				}
+			}
+		}
+		printf ("%-9s\tgeneric %8.2f ns\t%s %8.2f ns\tspeedup %.2fx\n",
+			test[t], best[0], geo->name, best[1], best[0] / best[1]);
+	}
+	printf ("==============================================================\n");
+}//geometryBench
@@ -0,0 +1,70 @@
+/******************************************************************
+ * Hot paths specialised for one disk geometry.                   *
+ * Included by geometry.c once per profile with:                  *
+ *   GEO_BS      block size in bytes                              *
+ *   GEO_DC      number of direct pointers in an iNode            *
+ *   GEO_SUFFIX  suffix of the generated function names           *
+ * For fixed profiles GEO_BS/GEO_DC are constants so the compiler *
+ * turns the block divisions into shifts or multiplications,      *
+ * folds the address math and unrolls the slot and hash loops;    *
+ * the generic profile passes the runtime values instead.         *
+ * No include guard: this file is meant to be included again.     *
+ *****************************************************************/
+#define GEO_CAT2(a, b)	a##_##b
+#define GEO_CAT(a, b)		GEO_CAT2(a, b)
+#define GEO_FN(name)		GEO_CAT(name, GEO_SUFFIX)
+#define GEO_SLOTS				(GEO_BS / (int32_t)sizeof (DirEntry_t))
+
+// Disk block holding the byte at addr
+static int64_t GEO_FN(blockOf) (const void *addr) {
+	return ((const char *)addr - (const char *)disk) / GEO_BS;
+}
+
+// Address of data block n
+static char *GEO_FN(dataBlock) (int64_t n) {
+	return (char *)disk + (geoFirstData + n) * GEO_BS;
+}
+
+// iNode number of the entry name of type ft in directory dirNb, -1 if none,
+// -5 if a directory block can't be read.
+// Entries of a directory block are chained in consecutive slots from its start
+// and names are zero padded, so they compare as fixed-size keys.
+static int64_t GEO_FN(lookup) (int64_t dirNb, const char *name, int8_t ft) {
+	char key[FILENAME_LENGTH];
+	if (strlen (name) > FILENAME_LENGTH) {
+		return -1;
+	}
+	strncpy (key, name, FILENAME_LENGTH);
+
+	Inode_t *dir = getInode (dirNb);
+	for (int32_t i=0; i<GEO_DC; i++) {
+		if (dir->ptr[i] == -1) {
+			break;
+		}
+		DirEntry_t *e = (DirEntry_t *)GEO_FN(dataBlock) (dir->ptr[i]);
+		if (devAccess (e, GEO_BS, DEV_READ) != 0) {
+			return -5;
+		}
+		for (int32_t k=0; k<GEO_SLOTS; k++) {
+			if (e[k].iNodeNb != -1
+			&& memcmp (e[k].fileName, key, FILENAME_LENGTH) == 0
+			&& getInode (e[k].iNodeNb)->type == ft) {
+				return e[k].iNodeNb;
+			}
+			if (e[k].next == NULL) {
+				break;
+			}
+		}
+	}
+	return -1;
+}
+
+// Hash of one data block
+static uint64_t GEO_FN(blockHash) (const char *data) {
+	return hash64 (data, GEO_BS);
+}
+
+#undef GEO_SLOTS
+#undef GEO_FN
+#undef GEO_CAT
+#undef GEO_CAT2
@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "vsfs.h"
+#include "library.h"
+
+extern void *disk;
+
+/*************************************************************
+ * iNode allocation.                                         *
+ * Next-fit over the iNode bit map: no iNode below hint is   *
+ * free, so a search starts there and skips whole 64-bit     *
+ * words of used iNodes. Freeing an iNode lowers the hint.   *
+ * With millions of iNodes an allocation touches a few words *
+ * instead of rescanning the map from the start.             *
+ * The superblock iNode counters are updated on the way.     *
+ ************************************************************/
+static int64_t hint = 0;
+
+static uint8_t *getINodeBM () {
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	return (uint8_t *) (disk + sb->blockSize);
+}
+
+static int64_t getINodeCnt () {
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	return sb->iNodeTabSize * sb->blockSize / sb->iNodeSize;
+}
+
+/**********************************************
+ * Reset the search hint (at mount)           *
+ *********************************************/
+void iNodeBuild () {
+	hint = 0;
+}//iNodeBuild
+
+/**********************************************
+ * Take the first free iNode and set it in    *
+ * the iNode bit map.                         *
+ * return iNode number, -1 if none is free    *
+ *        -5 if the bit map can't be read     *
+ *********************************************/
+int64_t iNodeAlloc () {
+	assert (disk != NULL);
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	uint8_t *bm = getINodeBM ();
+	int64_t cnt = getINodeCnt ();
+
+	// Counters tell a full table without scanning it
+	if (sb->freeINodeCnt == 0) {
+		return -1;
+	}
+	int64_t n = hint;
+	while (n < cnt) {
+		if ((n % 64) == 0 && n + 64 <= cnt) {
+			uint64_t w;
+			memcpy (&w, bm + n/8, 8);
+			if (w == UINT64_MAX) {
+				n += 64;
+				continue;
+			}
+		}
+		if ((bm[n/8] & (1 << (n%8))) == 0) {
+			if (devAccess (bm + hint/8, n/8 - hint/8 + 1, DEV_READ) != 0) {
+				return -5;
+			}
+			bm[n/8] |= (1 << (n%8));
+			csumUpdate (bm + n/8, 1);
+			sb->freeINodeCnt--;
+			csumUpdate (sb, sizeof (SuperBlock_t));
+			hint = n + 1;
+			return n;
+		}
+		n++;
+	}
+	hint = cnt;
+	return -1;
+}//iNodeAlloc
+
+/**********************************************
+ * Clear iNode n in the iNode bit map         *
+ *********************************************/
+void iNodeFree (int64_t n) {
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	uint8_t *bm = getINodeBM ();
+	assert (n >= 0 && n < getINodeCnt ());
+	assert (bm[n/8] & (1 << (n%8)));
+	bm[n/8] &= ~(1 << (n%8));
+	csumUpdate (bm + n/8, 1);
+	sb->freeINodeCnt++;
+	csumUpdate (sb, sizeof (SuperBlock_t));
+	if (n < hint) {
+		hint = n;
+	}
+}//iNodeFree
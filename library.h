@@ -11,35 +11,215 @@
 char *getToken (char **, const char); 
 
 // Return TRUE if iNodeNb is a directory
-bool isDirectory (int32_t);
+bool isDirectory (int64_t);
 
 // Reset specific bit in bitmap
-void resetBitInBB (int8_t *, int32_t);
+void resetBitInBB (int8_t *, int64_t);
 
 // return first null bit in BM and set it to 1
-int32_t findAndSetBB (int8_t *);
+int64_t findAndSetBB (int8_t *);
 
 // return pointer to the top of a data block		
-void *getDataBlock (int32_t);
+void *getDataBlock (int64_t);
 
 // Return the number of files stored in directory from iNodeNb 
-int32_t getFileCnt (int32_t);
+int32_t getFileCnt (int64_t);
 
 // return first null bit in DATA BM and set it to 1
-int32_t getFreeDataBlockNb ();		
+int64_t getFreeDataBlockNb ();		
 
 // return first null bit in iNodes BM and set it to 1
-int32_t getFreeInodeNb();
+int64_t getFreeInodeNb();
 
 // return pointer to iNode of specific number
-Inode_t *getInode (int32_t);
+Inode_t *getInode (int64_t);
 
 // Return the iNode number of a file knowning the iNodeNb of its parent, its name and type.
-int32_t getInodeNbFromParent (int32_t, char *, int8_t);
+int64_t getInodeNbFromParent (int64_t, char *, int8_t);
 
 // Return the iNode number of a file knowning its full path and type.
-int32_t getInodeNbFromPath (char *, int8_t);
+int64_t getInodeNbFromPath (char *, int8_t);
 
 // Update currDir when moving up one level
 void moveDirUp ();
+
+// Reset the iNode allocation hint (at mount)
+void iNodeBuild ();
+
+// Take the first free iNode. Return its number, -1 if none, -5 I/O error
+int64_t iNodeAlloc ();
+
+// Free an iNode
+void iNodeFree (int64_t);
+
+// iNode number of an absolute path and type, -1 if none, -5 I/O error (reads charged to the device)
+int64_t pathLookup (const char *, int8_t);
+
+// Read entries of a directory from a cursor, untraced (see vsfs_readDir)
+int32_t dirRead (DirCursor_t *, Dirent_t *, int32_t);
+
+// Number of data blocks an iNode points to
+int64_t subtreeOwnBlocks (Inode_t *);
+
+// Add entries and blocks to a directory and all directories above it
+void subtreeAdd (int64_t, int64_t, int64_t);
+
+// An entry reaching n levels down was added to a directory: raise the depths above
+void subtreeDepthAdd (int64_t, int32_t);
+
+// An entry reaching n levels down was removed from a directory: lower the depths above
+void subtreeDepthRemove (int64_t, int32_t);
+
+// Rebuild the free-extent index of data blocks from the data BM (at mount)
+void extentBuild ();
+
+// Release the free-extent index
+void extentRelease ();
+
+// Best-fit allocation of n contiguous data blocks. Return first block or -1
+int64_t extentAlloc (int64_t);
+
+// Allocate n data blocks starting at a given block. Return it or -1 if not free
+int64_t extentAllocAt (int64_t, int64_t);
+
+// Free n data blocks starting at a given block
+void extentFree (int64_t, int64_t);
+
+// Free n data blocks given in increasing order (word-level bit map update)
+void extentFreeBatch (const int64_t *, int64_t);
+
+// Total data blocks, free data blocks, free extents, largest free extent
+void extentStats (int64_t *, int64_t *, int64_t *, int64_t *);
+
+// Deferred freeing of data blocks (see reclaim.c)
+void reclaimStart ();
+void reclaimRelease ();
+
+// Queue a data block with no reference left to be cleared and freed
+void reclaimBlock (int64_t);
+
+// Free every queued block now. Return number of blocks freed
+int64_t reclaimDrain ();
+
+// Blocks queued, blocks cleared by memset, blocks cleared by page discard
+void reclaimStats (int64_t *, int64_t *, int64_t *);
+
+// Hot paths specialised for one disk geometry (see geometry.c)
+typedef struct Geometry {
+	const char *name;
+	int32_t blockSize;										// 0 <=> any (generic)
+	int32_t directCnt;
+	int64_t (*lookup) (int64_t, const char *, int8_t);	// entry of a directory, -1 if none, -5 I/O error
+	uint64_t (*blockHash) (const char *);			// hash of one data block
+	int64_t (*blockOf) (const void *);				// disk block holding an address
+	char *(*dataBlock) (int64_t);							// address of a data block
+} Geometry_t;
+
+// Profile selected at mount
+extern const Geometry_t *geo;
+
+// Select the geometry profile of the mounted disk
+void geometrySelect ();
+
+// Compare generic and selected profile over n iterations
+void geometryBench (int64_t);
+
+// 64-bit non-cryptographic hash of a buffer
+uint64_t blockHashOf (const char *, int32_t);
+
+// Rebuild data block reference counts and hash index from the iNode table (at mount)
+void dedupBuild ();
+
+// Release reference counts and hash index
+void dedupRelease ();
+
+// Find an indexed block identical to one block of data and reference it. Return it or -1
+int64_t dedupFind (const char *);
+
+// First reference to a new data block. TRUE to index it for sharing
+void dedupHold (int64_t, bool);
+
+// Number of references to a data block
+int32_t dedupRefCnt (int64_t);
+
+// Unindex a data block with a single reference before rewriting it
+void dedupUnindex (int64_t);
+
+// Drop a reference to a data block. Return references left (0 <=> caller frees it)
+int32_t dedupUnref (int64_t);
+
+// Share identical blocks of all data files. Return number of blocks freed
+int64_t dedupScan ();
+
+// File blocks referenced, stored and shared
+void dedupStats (int64_t *, int64_t *, int64_t *);
+
+// Select the CRC32C implementation (hardware if available)
+void crc32cInit ();
+
+// CRC32C of a buffer
+uint32_t crc32c (const void *, size_t);
+
+// TRUE if CRC32C uses the CPU instruction
+bool crc32cHardware ();
+
+// Place the checksum table at the end of a new disk and reserve its blocks
+void csumFormat ();
+
+// Compute the checksum of every block (at mount)
+void csumBuild ();
+
+// Stop keeping checksums (at unmount)
+void csumRelease ();
+
+// Recompute checksums of the blocks covering a memory range just written
+void csumUpdate (const void *, int64_t);
+
+// Verify the blocks covering a memory range. Return 0 or -5 if corrupted
+int32_t csumCheck (const void *, int32_t);
+
+// Verify all blocks with n threads. Return corrupted blocks count, first one in *
+int64_t csumVerifyAll (int32_t, int64_t *);
+
+// LZ compression of a buffer. Return compressed size or -1 if it does not fit
+int32_t lzCompress (const char *, int32_t, char *, int32_t);
+
+// LZ decompression of a buffer. Return size or -1 if corrupted or does not fit
+int32_t lzDecompress (const char *, int32_t, char *, int32_t);
+
+// Start time of a traced API call (0 when not recording)
+int64_t traceBegin ();
+
+// Record a traced API call: operation, name, type/flag, data, length, result, start time
+void traceEnd (int8_t, const char *, int8_t, const char *, int32_t, int32_t, int64_t);
+
+// Record a traced vsfs_readDir call: cursor before the call, entries asked for, result, start time
+void traceReadDir (const DirCursor_t *, int32_t, int32_t, int64_t);
+
+// Shared-memory disk, writer side (see shm.c)
+int32_t shmCreate (const char *, int64_t);
+void *shmDisk ();
+bool shmShared ();
+void shmPublish ();
+void shmRelease ();
+
+// Bracket every update of the file system (no-op unless shared)
+void shmWriteBegin ();
+void shmWriteEnd ();
+
+// Simulated storage device (see device.c)
+#define DEV_READ		0
+#define DEV_WRITE		1
+#define DEV_TRIM		2				// background discard: the caller does not wait
+extern bool devActive;
+int32_t devIO (const void *, int64_t, int8_t);
+
+// Charge an access to len bytes from addr to the device (no-op without -dev).
+// Return 0, -5 if the read failed
+static inline int32_t devAccess (const void *addr, int64_t len, int8_t kind) {
+	return devActive ? devIO (addr, len, kind) : 0;
+}
+
+// TRUE <=> a read of a block through getDataBlock/getInode failed and was not reported yet
+bool devFault (int64_t);
 #endif
\ No newline at end of file
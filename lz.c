@@ -0,0 +1,145 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "vsfs.h"
+#include "library.h"
+
+/*****************************************************************
+ * Small LZ77 codec for file data (LZ4-like byte format).        *
+ * A sequence is:                                                *
+ *   token      high nibble literal count, low nibble match-4    *
+ *   [255...]   extra literal count when the nibble is 15        *
+ *   literals                                                    *
+ *   offset     2 bytes, little endian (absent in last sequence) *
+ *   [255...]   extra match length when the nibble is 15         *
+ * The last sequence only has literals.                          *
+ ****************************************************************/
+#define LZ_MINMATCH		4
+#define LZ_LASTLIT		5			// last bytes are always literals
+#define LZ_HASHLOG		12
+#define LZ_MAXOFFSET	65535
+
+static uint32_t read32 (const uint8_t *p) {
+	uint32_t v;
+	memcpy (&v, p, sizeof (v));
+	return v;
+}
+
+static uint32_t lzHash (uint32_t v) {
+	return (v * 2654435761u) >> (32 - LZ_HASHLOG);
+}
+
+// Write a length continuation (values >= 15 spill into 255-runs)
+static int32_t putLength (uint8_t *dst, int32_t pos, int32_t cap, int32_t len) {
+	while (len >= 255) {
+		if (pos >= cap) return -1;
+		dst[pos++] = 255;
+		len -= 255;
+	}
+	if (pos >= cap) return -1;
+	dst[pos++] = (uint8_t)len;
+	return pos;
+}
+
+static int32_t putSequence (uint8_t *dst, int32_t pos, int32_t cap,
+		const uint8_t *lit, int32_t litLen, int32_t offset, int32_t matchLen) {
+	if (pos >= cap) return -1;
+	int32_t tokenPos = pos++;
+	int32_t mCode = (offset == 0) ? 0 : matchLen - LZ_MINMATCH;
+	dst[tokenPos] = (uint8_t)(((litLen < 15 ? litLen : 15) << 4) | (mCode < 15 ? mCode : 15));
+
+	if (litLen >= 15 && (pos = putLength (dst, pos, cap, litLen - 15)) < 0) return -1;
+	if (pos + litLen > cap) return -1;
+	memcpy (dst + pos, lit, litLen);
+	pos += litLen;
+
+	if (offset == 0) return pos;
+	if (pos + 2 > cap) return -1;
+	dst[pos++] = (uint8_t)(offset & 0xff);
+	dst[pos++] = (uint8_t)(offset >> 8);
+	if (mCode >= 15 && (pos = putLength (dst, pos, cap, mCode - 15)) < 0) return -1;
+	return pos;
+}
+
+/*****************************************************
+ * Compress srcLen bytes of src into dst (cap bytes) *
+ * return compressed size, -1 if it does not fit     *
+ ****************************************************/
+int32_t lzCompress (const char *src, int32_t srcLen, char *dst, int32_t cap) {
+	const uint8_t *in = (const uint8_t *)src;
+	uint8_t *out = (uint8_t *)dst;
+	int32_t table[1 << LZ_HASHLOG];
+	int32_t ip = 0, anchor = 0, op = 0;
+
+	memset (table, 0xff, sizeof (table));
+	while (ip + LZ_MINMATCH <= srcLen - LZ_LASTLIT) {
+		uint32_t seq = read32 (in + ip);
+		uint32_t h = lzHash (seq);
+		int32_t ref = table[h];
+		table[h] = ip;
+
+		if (ref < 0 || ip - ref > LZ_MAXOFFSET || read32 (in + ref) != seq) {
+			ip++;
+			continue;
+		}
+		int32_t matchLen = LZ_MINMATCH;
+		while (ip + matchLen < srcLen - LZ_LASTLIT && in[ref + matchLen] == in[ip + matchLen]) {
+			matchLen++;
+		}
+		op = putSequence (out, op, cap, in + anchor, ip - anchor, ip - ref, matchLen);
+		if (op < 0) return -1;
+		ip += matchLen;
+		anchor = ip;
+	}
+	return putSequence (out, op, cap, in + anchor, srcLen - anchor, 0, 0);
+}//lzCompress
+
+/*******************************************************
+ * Decompress srcLen bytes of src into dst (cap bytes) *
+ * return decompressed size, -1 if src is corrupted    *
+ * or does not fit                                     *
+ ******************************************************/
+int32_t lzDecompress (const char *src, int32_t srcLen, char *dst, int32_t cap) {
+	const uint8_t *in = (const uint8_t *)src;
+	uint8_t *out = (uint8_t *)dst;
+	int32_t ip = 0, op = 0;
+
+	while (ip < srcLen) {
+		uint8_t token = in[ip++];
+
+		int32_t litLen = token >> 4;
+		if (litLen == 15) {
+			uint8_t b;
+			do {
+				if (ip >= srcLen) return -1;
+				b = in[ip++];
+				litLen += b;
+			} while (b == 255);
+		}
+		if (ip + litLen > srcLen || op + litLen > cap) return -1;
+		memcpy (out + op, in + ip, litLen);
+		ip += litLen;
+		op += litLen;
+		if (ip == srcLen) break;		// last sequence
+
+		if (ip + 2 > srcLen) return -1;
+		int32_t offset = in[ip] | (in[ip + 1] << 8);
+		ip += 2;
+		int32_t matchLen = (token & 0x0f);
+		if (matchLen == 15) {
+			uint8_t b;
+			do {
+				if (ip >= srcLen) return -1;
+				b = in[ip++];
+				matchLen += b;
+			} while (b == 255);
+		}
+		matchLen += LZ_MINMATCH;
+		if (offset == 0 || offset > op || op + matchLen > cap) return -1;
+		// Byte copy: the match may overlap what it produces
+		for (int32_t i=0; i<matchLen; i++, op++) {
+			out[op] = out[op - offset];
+		}
+	}
+	return op;
+}//lzDecompress
@@ -0,0 +1,217 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "vsfs.h"
+#include "library.h"
+
+extern void *disk;
+
+/*****************************************************************
+ * Deferred freeing of data blocks.                              *
+ * A block whose last reference goes away is queued instead of   *
+ * being zeroed and freed on the spot. A full batch is handed to *
+ * a background thread that sorts it and clears the blocks: runs *
+ * covering whole pages are discarded (the system gives back     *
+ * zero pages), the rest is zeroed. The next batch hand-over (or *
+ * reclaimDrain) returns the cleared blocks to the data bit map  *
+ * and the extent index in one word-level pass. Until then a     *
+ * queued block stays marked used, so it is never reallocated    *
+ * while being cleared. Two batches: one filled by vsfs, one     *
+ * cleared by the thread.                                        *
+ ****************************************************************/
+#define RECLAIM_BATCH		256
+
+static int64_t *batch[2] = {NULL, NULL};
+static int32_t batchLen[2] = {0, 0};
+static int32_t filling = 0;					// batch vsfs queues blocks into
+static int8_t busy = FALSE;				// TRUE <=> thread owns batch[1 - filling]
+static int8_t running = FALSE;
+static pthread_t worker;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static int64_t zeroedCnt = 0;				// blocks cleared by memset
+static int64_t discardCnt = 0;			// blocks cleared by page discard
+
+static int cmpBlock (const void *a, const void *b) {
+	int64_t x = *(const int64_t *)a;
+	int64_t y = *(const int64_t *)b;
+	return (x > y) - (x < y);
+}
+
+// Address of data block b. Not through getDataBlock: clearing a block
+// is not a read, so the device model must not charge one (or fail it).
+static char *blockAddr (int64_t b) {
+	return geo->dataBlock (b);
+}
+
+// Clear len bytes from addr: whole pages are dropped with madvise,
+// edges zeroed. A private disk reads the dropped pages back as zeros;
+// a shared one has them punched out of the memory object (MADV_REMOVE).
+// return number of bytes discarded
+static int64_t clearRange (char *addr, int64_t len) {
+	int64_t page = sysconf (_SC_PAGESIZE);
+	char *lo = (char *)(((uintptr_t)addr + page - 1) & ~(uintptr_t)(page - 1));
+	char *hi = (char *)(((uintptr_t)(addr + len)) & ~(uintptr_t)(page - 1));
+	int advice = shmShared () ? MADV_REMOVE : MADV_DONTNEED;
+	devAccess (addr, len, DEV_TRIM);
+	if (hi > lo && madvise (lo, hi - lo, advice) == 0) {
+		memset (addr, 0, lo - addr);
+		memset (hi, 0, addr + len - hi);
+		return hi - lo;
+	}
+	memset (addr, 0, len);
+	return 0;
+}
+
+// Sort a batch and clear each run of consecutive blocks.
+// return number of blocks discarded (the others were zeroed)
+static int64_t clearBatch (int64_t *blocks, int32_t n) {
+	int64_t discarded = 0;
+	int32_t blockSize = ((SuperBlock_t *)disk)->blockSize;
+	qsort (blocks, n, sizeof (int64_t), cmpBlock);
+	for (int32_t i=0; i<n; ) {
+		int32_t j = i + 1;
+		while (j < n && blocks[j] == blocks[j-1] + 1) {
+			j++;
+		}
+		int64_t len = (int64_t)(j - i) * blockSize;
+		discarded += clearRange (blockAddr (blocks[i]), len) / blockSize;
+		i = j;
+	}
+	return discarded;
+}
+
+static void *reclaimThread (void *arg) {
+	(void)arg;
+	pthread_mutex_lock (&lock);
+	while (running) {
+		if (!busy) {
+			pthread_cond_wait (&cond, &lock);
+			continue;
+		}
+		int32_t b = 1 - filling;
+		pthread_mutex_unlock (&lock);
+		int64_t discarded = clearBatch (batch[b], batchLen[b]);
+		pthread_mutex_lock (&lock);
+		discardCnt += discarded;
+		zeroedCnt += batchLen[b] - discarded;
+		busy = FALSE;
+		pthread_cond_broadcast (&cond);
+	}
+	pthread_mutex_unlock (&lock);
+	return NULL;
+}
+
+// Give the cleared batch back to the allocator, then hand the
+// filled one to the thread. return number of blocks given back
+static int64_t handOver () {
+	int32_t other = 1 - filling;
+	int64_t released = 0;
+
+	pthread_mutex_lock (&lock);
+	while (busy) {
+		pthread_cond_wait (&cond, &lock);
+	}
+	pthread_mutex_unlock (&lock);
+
+	if (batchLen[other] > 0) {
+		int32_t blockSize = ((SuperBlock_t *)disk)->blockSize;
+		for (int32_t i=0; i<batchLen[other]; i++) {
+			csumUpdate (blockAddr (batch[other][i]), blockSize);
+		}
+		extentFreeBatch (batch[other], batchLen[other]);
+		released = batchLen[other];
+		batchLen[other] = 0;
+	}
+	if (batchLen[filling] > 0) {
+		pthread_mutex_lock (&lock);
+		busy = TRUE;
+		filling = other;
+		pthread_cond_signal (&cond);
+		pthread_mutex_unlock (&lock);
+	}
+	return released;
+}
+
+/**********************************************
+ * Allocate the batches and start the thread. *
+ * Called at mount.                           *
+ *********************************************/
+void reclaimStart () {
+	reclaimRelease ();
+	batch[0] = malloc (RECLAIM_BATCH * sizeof (int64_t));
+	batch[1] = malloc (RECLAIM_BATCH * sizeof (int64_t));
+	assert (batch[0] != NULL && batch[1] != NULL);
+	batchLen[0] = batchLen[1] = 0;
+	filling = 0;
+	busy = FALSE;
+	zeroedCnt = discardCnt = 0;
+	running = TRUE;
+	int rc = pthread_create (&worker, NULL, reclaimThread, NULL);
+	assert (rc == 0);
+}//reclaimStart
+
+/**********************************************
+ * Free every queued block, stop the thread   *
+ * and release the batches.                   *
+ *********************************************/
+void reclaimRelease () {
+	if (!running) {
+		return;
+	}
+	reclaimDrain ();
+	pthread_mutex_lock (&lock);
+	running = FALSE;
+	pthread_cond_signal (&cond);
+	pthread_mutex_unlock (&lock);
+	pthread_join (worker, NULL);
+	free (batch[0]);
+	free (batch[1]);
+	batch[0] = batch[1] = NULL;
+}//reclaimRelease
+
+/**********************************************
+ * Queue data block b (no reference left) to  *
+ * be cleared and freed.                      *
+ *********************************************/
+void reclaimBlock (int64_t b) {
+	assert (running);
+	batch[filling][batchLen[filling]++] = b;
+	if (batchLen[filling] == RECLAIM_BATCH) {
+		handOver ();
+	}
+}//reclaimBlock
+
+/**********************************************
+ * Clear and free every queued block now.     *
+ * Used when the allocator runs short and     *
+ * before verifying checksums.                *
+ * return number of blocks freed              *
+ *********************************************/
+int64_t reclaimDrain () {
+	if (!running) {
+		return 0;
+	}
+	int64_t released = handOver ();
+	released += handOver ();
+	return released;
+}//reclaimDrain
+
+/**********************************************
+ * Report blocks waiting to be freed and how  *
+ * the freed ones were cleared so far.        *
+ *********************************************/
+void reclaimStats (int64_t *pending, int64_t *zeroed, int64_t *discarded) {
+	pthread_mutex_lock (&lock);
+	*pending = batchLen[0] + batchLen[1];
+	*zeroed = zeroedCnt;
+	*discarded = discardCnt;
+	pthread_mutex_unlock (&lock);
+}//reclaimStats
@@ -0,0 +1,515 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "vsfs.h"
+#include "library.h"
+
+extern void *disk;
+
+/*****************************************************************
+ * Shared-memory disk.                                           *
+ * With -shm the disk lives in a POSIX shared memory object, one *
+ * page of header followed by the image. The process that made   *
+ * it is the only writer; any number of processes attach to it   *
+ * read-only (-attach) and look up, list and stat files with     *
+ * plain loads, without a round trip to the writer.              *
+ * Publication is a sequence lock: the writer makes the counter  *
+ * odd around every update of the file system and even again     *
+ * after. A reader notes the counter, reads, and keeps the       *
+ * result only if the counter did not move. Readers never take a *
+ * lock nor write anything shared, so they never hold up the     *
+ * writer or each other; they only read again after a clash.     *
+ * Readers never follow DirEntry_t.next (an address in the       *
+ * writer): entries of a directory block sit in consecutive      *
+ * slots and only next == NULL (end of the chain) is used. Every *
+ * number read is range checked before use, since a read that    *
+ * clashed with the writer may see anything until validated.     *
+ ****************************************************************/
+#define SHM_MAGIC				0x5653464d	// set once the writer has mounted
+#define SHM_BENCHPATHS	256					// paths exercised by the reader bench
+
+typedef struct ShmHeader {
+	_Atomic uint32_t magic;			// SHM_MAGIC once the file system is mounted
+	int32_t writerPid;
+	int64_t diskSize;						// bytes of disk image after the header
+	_Atomic uint64_t seq;				// odd while the writer updates the disk
+} ShmHeader_t;
+
+static ShmHeader_t *hdr = NULL;
+static int64_t mapSize = 0;
+static int8_t writer = FALSE;
+static char shmName[PATH_MAXLEN + 1];
+
+// Reader side: geometry read once at attach, reads done again after a clash
+static int64_t iNodeCnt = 0;
+static int64_t dataCnt = 0;
+static int32_t slots = 0;
+static int64_t retryCnt = 0;
+
+static int64_t pageSize () {
+	return sysconf (_SC_PAGESIZE);
+}
+
+/**********************************************
+ * Create shared memory object name sized for *
+ * a disk of size bytes. vsfs_initDisk then   *
+ * formats the disk in it (see shmDisk).      *
+ * return 0, -1 if it can't be created (e.g.  *
+ * a writer already uses that name)           *
+ *********************************************/
+int32_t shmCreate (const char *name, int64_t size) {
+	int fd = shm_open (name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd == -1) {
+		printf ("shm: can't create %s (in use?)\n", name);
+		return -1;
+	}
+	mapSize = pageSize () + size;
+	void *p = MAP_FAILED;
+	if (ftruncate (fd, mapSize) == 0) {
+		p = mmap (NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close (fd);
+	if (p == MAP_FAILED) {
+		printf ("shm: can't map %lld bytes\n", (long long)mapSize);
+		shm_unlink (name);
+		return -1;
+	}
+	// A new object reads as zeros: the disk starts blank, like calloc
+	hdr = (ShmHeader_t *)p;
+	hdr->writerPid = getpid ();
+	hdr->diskSize = size;
+	atomic_store (&hdr->seq, 0);
+	writer = TRUE;
+	snprintf (shmName, sizeof (shmName), "%s", name);
+	return 0;
+}//shmCreate
+
+/**********************************************
+ * The disk image inside the shared mapping,  *
+ * NULL when not running with -shm            *
+ *********************************************/
+void *shmDisk () {
+	return (hdr == NULL) ? NULL : (char *)hdr + pageSize ();
+}//shmDisk
+
+/**********************************************
+ * TRUE <=> the disk is a shared mapping      *
+ *********************************************/
+bool shmShared () {
+	return hdr != NULL;
+}//shmShared
+
+/**********************************************
+ * Let readers in: called by the writer once  *
+ * the file system is mounted.                *
+ *********************************************/
+void shmPublish () {
+	if (hdr != NULL && writer) {
+		atomic_store_explicit (&hdr->magic, SHM_MAGIC, memory_order_release);
+	}
+}//shmPublish
+
+/**********************************************
+ * Writer: start an update of the file system *
+ * (readers running across it read again)     *
+ *********************************************/
+void shmWriteBegin () {
+	if (hdr == NULL) {
+		return;
+	}
+	uint64_t s = atomic_load_explicit (&hdr->seq, memory_order_relaxed);
+	assert ((s & 1) == 0);
+	atomic_store_explicit (&hdr->seq, s + 1, memory_order_relaxed);
+	// The odd count is visible before any change to the disk
+	atomic_thread_fence (memory_order_release);
+}//shmWriteBegin
+
+/**********************************************
+ * Writer: the update is complete             *
+ *********************************************/
+void shmWriteEnd () {
+	if (hdr == NULL) {
+		return;
+	}
+	uint64_t s = atomic_load_explicit (&hdr->seq, memory_order_relaxed);
+	atomic_store_explicit (&hdr->seq, s + 1, memory_order_release);
+}//shmWriteEnd
+
+/**********************************************
+ * Unmap the disk. The writer also removes    *
+ * the name (attached readers keep their      *
+ * mapping until they exit).                  *
+ *********************************************/
+void shmRelease () {
+	if (hdr == NULL) {
+		return;
+	}
+	munmap (hdr, mapSize);
+	if (writer) {
+		shm_unlink (shmName);
+	}
+	hdr = NULL;
+	disk = NULL;
+	writer = FALSE;
+}//shmRelease
+
+/**********************************************
+ * Attach read-only to the disk published by  *
+ * the writer of shared memory object name.   *
+ * return 0, -1 if there is none (yet)        *
+ *********************************************/
+int32_t shmAttach (const char *name) {
+	int fd = shm_open (name, O_RDONLY, 0);
+	if (fd == -1) {
+		printf ("shm: no disk named %s\n", name);
+		return -1;
+	}
+	ShmHeader_t *h = mmap (NULL, pageSize (), PROT_READ, MAP_SHARED, fd, 0);
+	if (h == MAP_FAILED || atomic_load_explicit (&h->magic, memory_order_acquire) != SHM_MAGIC) {
+		printf ("shm: %s is not ready\n", name);
+		if (h != MAP_FAILED) {
+			munmap (h, pageSize ());
+		}
+		close (fd);
+		return -1;
+	}
+	mapSize = pageSize () + h->diskSize;
+	munmap (h, pageSize ());
+	void *p = mmap (NULL, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+	if (p == MAP_FAILED) {
+		printf ("shm: can't map %s\n", name);
+		return -1;
+	}
+	hdr = (ShmHeader_t *)p;
+	disk = (char *)p + pageSize ();
+	writer = FALSE;
+
+	// The geometry never changes once formatted
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+	assert (sb->signature == MAGICNB && sb->version == VSFS_VERSION);
+	iNodeCnt = sb->iNodeTabSize * sb->blockSize / sb->iNodeSize;
+	dataCnt = sb->blockCnt - 1 - sb->iNodeBMSize - sb->dataBMSize - sb->iNodeTabSize;
+	slots = sb->blockSize / (int32_t)sizeof (DirEntry_t);
+	retryCnt = 0;
+	return 0;
+}//shmAttach
+
+// Counter value at the start of a read, waiting out an update in progress
+static uint64_t readBegin () {
+	uint64_t s;
+	while ((s = atomic_load_explicit (&hdr->seq, memory_order_acquire)) & 1) {
+		;
+	}
+	return s;
+}
+
+// TRUE <=> nothing was written since readBegin returned s
+static int readValid (uint64_t s) {
+	atomic_thread_fence (memory_order_acquire);
+	if (atomic_load_explicit (&hdr->seq, memory_order_relaxed) == s) {
+		return TRUE;
+	}
+	retryCnt++;
+	return FALSE;
+}
+
+// Type of iNode n, 0 if n is out of range
+static int8_t rdType (int64_t n) {
+	return (n >= 0 && n < iNodeCnt) ? getInode (n)->type : 0;
+}
+
+// Call f for each used entry of directory dirNb (a copy of the entry),
+// until it returns non zero. return that value, 0 if none
+typedef int64_t (*EntryFn_t) (const DirEntry_t *, void *);
+static int64_t rdEach (int64_t dirNb, EntryFn_t f, void *arg) {
+	Inode_t dir;
+	if (rdType (dirNb) != FT_DIR) {
+		return 0;
+	}
+	memcpy (&dir, getInode (dirNb), sizeof (Inode_t));
+	for (int32_t i=0; i<parameters.directCnt; i++) {
+		if (dir.ptr[i] < 0 || dir.ptr[i] >= dataCnt) {
+			break;
+		}
+		const DirEntry_t *e = (const DirEntry_t *)getDataBlock (dir.ptr[i]);
+		for (int32_t k=0; k<slots; k++) {
+			DirEntry_t d;
+			memcpy (&d, &e[k], sizeof (DirEntry_t));
+			if (d.iNodeNb >= 0 && d.iNodeNb < iNodeCnt) {
+				int64_t r = f (&d, arg);
+				if (r != 0) {
+					return r;
+				}
+			}
+			if (d.next == NULL) {
+				break;
+			}
+		}
+	}
+	return 0;
+}
+
+typedef struct Match {
+	char key[FILENAME_LENGTH];		// zero padded name
+	int8_t type;
+} Match_t;
+
+static int64_t matchEntry (const DirEntry_t *d, void *arg) {
+	Match_t *m = (Match_t *)arg;
+	if (memcmp (d->fileName, m->key, FILENAME_LENGTH) == 0 && rdType (d->iNodeNb) == m->type) {
+		return d->iNodeNb + 1;
+	}
+	return 0;
+}
+
+// iNode number of absolute path of type ft, -1 if none
+static int64_t rdWalk (const char *path, int8_t ft) {
+	int64_t cur = 0;
+	const char *p = path;
+	while (*p == '/') {
+		p++;
+	}
+	if (*p == 0) {
+		return (ft == FT_DIR) ? 0 : -1;
+	}
+	while (*p != 0) {
+		const char *end = strchr (p, '/');
+		size_t len = (end == NULL) ? strlen (p) : (size_t)(end - p);
+		if (len > FILENAME_LENGTH) {
+			return -1;
+		}
+		Match_t m;
+		memset (m.key, 0, FILENAME_LENGTH);
+		memcpy (m.key, p, len);
+		p += len;
+		while (*p == '/') {
+			p++;
+		}
+		m.type = (*p == 0) ? ft : FT_DIR;
+		cur = rdEach (cur, matchEntry, &m) - 1;
+		if (cur == -1) {
+			return -1;
+		}
+	}
+	return cur;
+}
+
+/**********************************************
+ * Reader: iNode number of absolute path of   *
+ * type ft, -1 if none                        *
+ *********************************************/
+int64_t shmLookup (const char *path, int8_t ft) {
+	for (;;) {
+		uint64_t s = readBegin ();
+		int64_t n = rdWalk (path, ft);
+		if (readValid (s)) {
+			return n;
+		}
+	}
+}//shmLookup
+
+/**********************************************
+ * Reader: copy the iNode of absolute path    *
+ * (directory or file) into out.              *
+ * return 0, -1 if none                       *
+ *********************************************/
+int32_t shmStat (const char *path, Inode_t *out) {
+	for (;;) {
+		uint64_t s = readBegin ();
+		int64_t n = rdWalk (path, FT_DIR);
+		if (n == -1) {
+			n = rdWalk (path, FT_FIL);
+		}
+		if (n != -1) {
+			memcpy (out, getInode (n), sizeof (Inode_t));
+		}
+		if (readValid (s)) {
+			return (n == -1) ? -1 : 0;
+		}
+	}
+}//shmStat
+
+typedef struct Fill {
+	Dirent_t *buf;
+	int32_t cnt;
+	int32_t filled;
+} Fill_t;
+
+static int64_t fillEntry (const DirEntry_t *d, void *arg) {
+	Fill_t *f = (Fill_t *)arg;
+	if (f->filled == f->cnt) {
+		return 1;
+	}
+	Dirent_t *e = &f->buf[f->filled++];
+	e->iNodeNb = d->iNodeNb;
+	e->type = rdType (d->iNodeNb);
+	memcpy (e->fileName, d->fileName, FILENAME_LENGTH);
+	e->fileName[FILENAME_LENGTH] = 0;
+	return 0;
+}
+
+/**********************************************
+ * Reader: fill buf with up to cnt entries of *
+ * directory path.                            *
+ * return number of entries, -1 if no such    *
+ * directory                                  *
+ *********************************************/
+int32_t shmReadDir (const char *path, Dirent_t *buf, int32_t cnt) {
+	for (;;) {
+		uint64_t s = readBegin ();
+		Fill_t f = {buf, cnt, 0};
+		int64_t n = rdWalk (path, FT_DIR);
+		if (n != -1) {
+			rdEach (n, fillEntry, &f);
+		}
+		if (readValid (s)) {
+			return (n == -1) ? -1 : f.filled;
+		}
+	}
+}//shmReadDir
+
+static int isDot (const char *name) {
+	return strcmp (name, ".") == 0 || strcmp (name, "..") == 0 || strcmp (name, "/") == 0;
+}
+
+static double nowSec () {
+	struct timespec t;
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// procCnt processes do n lookups, readdirs and stats each over the
+// files of the disk (up to SHM_BENCHPATHS of them, breadth first)
+static void readerBench (int64_t n, int32_t procCnt) {
+	static char paths[SHM_BENCHPATHS][PATH_MAXLEN + 1];
+	static int8_t type[SHM_BENCHPATHS];
+	Dirent_t ents[LS_BUFSIZE];
+
+	int32_t cnt = 1;
+	strcpy (paths[0], "/");
+	type[0] = FT_DIR;
+	for (int32_t i=0; i<cnt; i++) {
+		if (type[i] != FT_DIR) {
+			continue;
+		}
+		int32_t got = shmReadDir (paths[i], ents, LS_BUFSIZE);
+		for (int32_t k=0; k<got && cnt<SHM_BENCHPATHS; k++) {
+			if (isDot (ents[k].fileName)
+			|| strlen (paths[i]) + 1 + strlen (ents[k].fileName) > PATH_MAXLEN) {
+				continue;
+			}
+			size_t len = strlen (paths[i]);
+			memcpy (paths[cnt], paths[i], len);
+			if (i != 0) {
+				paths[cnt][len++] = '/';
+			}
+			strcpy (paths[cnt] + len, ents[k].fileName);
+			type[cnt++] = ents[k].type;
+		}
+	}
+
+	printf ("==== Reader bench: %d processes, %lld ops each, %d paths ====\n", procCnt, (long long)n, cnt);
+	fflush (stdout);
+	double t0 = nowSec ();
+	for (int32_t p=0; p<procCnt; p++) {
+		pid_t pid = fork ();
+		assert (pid != -1);
+		if (pid != 0) {
+			continue;
+		}
+		volatile int64_t sink = 0;
+		Inode_t st;
+		double c0 = nowSec ();
+		for (int64_t i=0; i<n; i++) {
+			int32_t j = (int32_t)((i * 7 + p) % cnt);
+			switch (i % 3) {
+			case 0:
+				sink += shmLookup (paths[j], type[j]);
+				break;
+			case 1:
+				sink += shmStat (paths[j], &st);
+				break;
+			default:
+				sink += shmReadDir ((type[j] == FT_DIR) ? paths[j] : "/", ents, LS_BUFSIZE);
+				break;
+			}
+		}
+		double c1 = nowSec ();
+		printf ("reader %d: %.0f ops/s, %lld reads repeated\n", p, n / (c1 - c0), (long long)retryCnt);
+		fflush (stdout);
+		_exit (0);
+	}
+	for (int32_t p=0; p<procCnt; p++) {
+		wait (NULL);
+	}
+	double t1 = nowSec ();
+	printf ("total: %.0f ops/s\n", (double)n * procCnt / (t1 - t0));
+	printf ("==============================================================\n");
+}
+
+/**********************************************
+ * Read-only session on an attached disk:     *
+ * run the reader bench (benchCnt ops in each *
+ * of procCnt processes) or read commands     *
+ *   ls path / stat path / q                  *
+ * from stdin (paths are absolute).           *
+ *********************************************/
+void shmReader (int64_t benchCnt, int32_t procCnt) {
+	if (benchCnt != 0) {
+		readerBench (benchCnt, (procCnt < 1) ? 1 : procCnt);
+		return;
+	}
+
+	char line[CMDE_LENGTH + 2];
+	Dirent_t ents[LS_BUFSIZE];
+	Inode_t st;
+	printf ("(reader) ");
+	while (fgets (line, sizeof (line), stdin) != NULL) {
+		line[strcspn (line, "\n")] = 0;
+		char *rest = line;
+		char *cmde = getToken (&rest, ' ');
+		char *param = getToken (&rest, ' ');
+		if (cmde == NULL) {
+			;
+		} else if (strcmp (cmde, "q") == 0) {
+			break;
+		} else if (strcmp (cmde, "ls") == 0) {
+			int32_t got = shmReadDir ((param == NULL) ? "/" : param, ents, LS_BUFSIZE);
+			if (got < 0) {
+				printf ("%s no such directory\n", param);
+			}
+			for (int32_t k=0; k<got; k++) {
+				// Like ls in the writer: no root, dot nor dot-dot
+				if (ents[k].iNodeNb == 0 || isDot (ents[k].fileName)) {
+					continue;
+				}
+				printf ("%s%s ", ents[k].fileName, (ents[k].type == FT_DIR) ? "/" : "");
+			}
+			printf ("\n");
+		} else if (strcmp (cmde, "stat") == 0 && param != NULL) {
+			if (shmStat (param, &st) != 0) {
+				printf ("%s not found\n", param);
+			} else if (st.type == FT_DIR) {
+				printf ("iNode %lld directory: %lld entries, %lld blocks, depth %d below\n",
+					(long long)st.number, (long long)st.subEntries, (long long)st.subBlocks, st.subDepth);
+			} else {
+				printf ("iNode %lld file: %lld bytes (%lld stored)\n",
+					(long long)st.number, (long long)st.size, (long long)st.storedSize);
+			}
+		} else {
+			printf ("reader commands: ls path, stat path, q\n");
+		}
+		printf ("(reader) ");
+	}
+	printf ("%lld reads repeated\n", (long long)retryCnt);
+}//shmReader
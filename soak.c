@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "vsfs.h"
+#include "library.h"
+
+extern char *currDir;
+
+// Heap calls made by vsfs code. The Makefile links with --wrap=malloc
+// and --wrap=free so that every call from our objects lands here first.
+static int64_t allocCnt = 0;
+static int64_t freeCnt = 0;
+
+void *__real_malloc (size_t);
+void __real_free (void *);
+
+void *__wrap_malloc (size_t size) {
+	allocCnt++;
+	return __real_malloc (size);
+}
+
+void __wrap_free (void *p) {
+	if (p != NULL) {
+		freeCnt++;
+	}
+	__real_free (p);
+}
+
+// One soak cycle: every command succeeds and leaves the disk as it was.
+// %d is replaced by a name index so that slots get reused in different orders.
+static const char *script[] = {
+	"mkdir s%d", "cd s%d", "make f%d", "make g%d", "ls", "rmf f%d",
+	"rmf g%d", "cd ..", "rmd s%d", "make f%d", "ls", "rmf f%d"
+};
+#define SCRIPTLEN	(int64_t)(sizeof (script) / sizeof (script[0]))
+
+/*********************************************
+ * Resident set size in KiB. Use /proc when  *
+ * available, peak RSS from getrusage if not *
+ ********************************************/
+static int64_t getRSS () {
+	long pages;
+	FILE *f = fopen ("/proc/self/statm", "r");
+	if (f != NULL) {
+		int ok = fscanf (f, "%*s %ld", &pages);
+		fclose (f);
+		if (ok == 1) {
+			return (int64_t)pages * (sysconf (_SC_PAGESIZE) / 1024);
+		}
+	}
+	struct rusage ru;
+	getrusage (RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}//getRSS
+
+static void report (int64_t done, int64_t rss0, int64_t alloc0, int64_t free0) {
+	int64_t rss = getRSS ();
+	printf ("%12lld ops  RSS %6lld KiB (%+lld)  malloc %lld  free %lld\n",
+		(long long)done, (long long)rss, (long long)(rss - rss0),
+		(long long)(allocCnt - alloc0), (long long)(freeCnt - free0));
+}//report
+
+/*****************************************************
+ * Run opCnt commands through parseAndExecute and    *
+ * report RSS and heap calls at 10 checkpoints.      *
+ * Shell output is sent to /dev/null while running.  *
+ ****************************************************/
+void soak (int64_t opCnt) {
+	char cmdLine[CMDE_LENGTH + 1];
+	struct timespec t0, t1;
+
+	if (opCnt <= 0) {
+		printf ("soak: bad operation count\n");
+		return;
+	}
+
+	int devNull = open ("/dev/null", O_WRONLY);
+	assert (devNull != -1);
+	fflush (stdout);
+	int savedOut = dup (STDOUT_FILENO);
+	assert (savedOut != -1);
+
+	printf ("==== Soak: %lld operations ====\n", (long long)opCnt);
+	int64_t rss0 = getRSS ();
+	int64_t alloc0 = allocCnt;
+	int64_t free0 = freeCnt;
+	report (0, rss0, alloc0, free0);
+
+	clock_gettime (CLOCK_MONOTONIC, &t0);
+	int64_t step = (opCnt < 10) ? 1 : opCnt / 10;
+	for (int64_t done = 0; done < opCnt; ) {
+		int64_t stop = (done + step < opCnt) ? done + step : opCnt;
+
+		fflush (stdout);
+		dup2 (devNull, STDOUT_FILENO);
+		for (; done < stop; done++) {
+			int nameIdx = (int)((done / SCRIPTLEN) % 10);
+			snprintf (cmdLine, sizeof (cmdLine), script[done % SCRIPTLEN], nameIdx);
+			parseAndExecute (cmdLine);
+		}
+		fflush (stdout);
+		dup2 (savedOut, STDOUT_FILENO);
+
+		report (done, rss0, alloc0, free0);
+	}
+	clock_gettime (CLOCK_MONOTONIC, &t1);
+
+	double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf ("%.3f s, %.0f ops/s, current directory %s\n", secs, opCnt / secs, currDir);
+	printf ("===============================\n");
+
+	close (savedOut);
+	close (devNull);
+}//soak
@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <fnmatch.h>
+
+#include "vsfs.h"
+#include "library.h"
+
+extern void *disk;
+extern char *currDir;
+
+/*****************************************************************
+ * Subtree aggregates.                                           *
+ * Every directory iNode holds, for everything below it:         *
+ *   subEntries  files and directories (dot entries excluded)    *
+ *   subBlocks   data blocks referenced (its own blocks included)*
+ *   subDepth    longest path down to an entry (0 <=> empty)     *
+ * create/remove/write apply their change to the parent and the  *
+ * delta is carried up the ".." chain to the root, so du reads   *
+ * an answer instead of walking the tree and find can skip the   *
+ * empty subtrees and stop reading a directory once its entries  *
+ * are all seen.                                                 *
+ ****************************************************************/
+
+// iNode of the parent directory (".." is the second entry of the
+// first block), -1 for the root.
+static int64_t parentOf (int64_t dirNb) {
+	if (dirNb == 0) {
+		return -1;
+	}
+	DirEntry_t *e = (DirEntry_t *)getDataBlock (getInode (dirNb)->ptr[0]);
+	return e[1].iNodeNb;
+}
+
+/**********************************************
+ * Number of data blocks an iNode points to   *
+ *********************************************/
+int64_t subtreeOwnBlocks (Inode_t *node) {
+	int64_t n = 0;
+	for (int32_t i=0; i<parameters.directCnt; i++) {
+		if (node->ptr[i] != -1) {
+			n++;
+		}
+	}
+	return n;
+}//subtreeOwnBlocks
+
+/**********************************************
+ * Add entries and blocks to directory dirNb  *
+ * and to every directory above it.           *
+ *********************************************/
+void subtreeAdd (int64_t dirNb, int64_t entries, int64_t blocks) {
+	if (entries == 0 && blocks == 0) {
+		return;
+	}
+	for (int64_t n = dirNb; n != -1; n = parentOf (n)) {
+		Inode_t *dir = getInode (n);
+		assert (dir->type == FT_DIR);
+		dir->subEntries += entries;
+		dir->subBlocks += blocks;
+		assert (dir->subEntries >= 0 && dir->subBlocks >= 0);
+		csumUpdate (dir, sizeof (Inode_t));
+	}
+}//subtreeAdd
+
+/**********************************************
+ * An entry reaching depth levels down (1 for *
+ * a file, 1 + its depth for a directory) was *
+ * added to directory dirNb: raise dirNb and  *
+ * its ancestors while it goes deeper than    *
+ * they did. No directory is read.            *
+ *********************************************/
+void subtreeDepthAdd (int64_t dirNb, int32_t depth) {
+	for (int64_t n = dirNb; n != -1; n = parentOf (n)) {
+		Inode_t *dir = getInode (n);
+		if (depth <= dir->subDepth) {
+			return;
+		}
+		dir->subDepth = depth;
+		csumUpdate (dir, sizeof (Inode_t));
+		depth++;
+	}
+}//subtreeDepthAdd
+
+// Depth of directory dirNb (parent up) from its entries
+static int32_t depthScan (int64_t dirNb, int64_t up) {
+	DirCursor_t cursor;
+	Dirent_t ents[READDIR_BATCH];
+	int32_t depth = 0;
+
+	cursor.iNodeNb = dirNb;
+	cursor.ptrIdx = 0;
+	cursor.offset = 0;
+	int32_t cnt;
+	while ((cnt = dirRead (&cursor, ents, READDIR_BATCH)) > 0) {
+		for (int32_t i=0; i<cnt; i++) {
+			if (ents[i].iNodeNb == dirNb || ents[i].iNodeNb == up
+			|| strcmp (ents[i].fileName, "/") == 0) {
+				continue;			// dot entries and the root name
+			}
+			int32_t d = 1;
+			if (ents[i].type == FT_DIR) {
+				d += getInode (ents[i].iNodeNb)->subDepth;
+			}
+			if (d > depth) {
+				depth = d;
+			}
+		}
+	}
+	return depth;
+}
+
+/**********************************************
+ * An entry reaching depth levels down was    *
+ * removed from directory dirNb. Only when it *
+ * was the deepest one is dirNb read again to *
+ * find its new depth, and then its parent    *
+ * the same way while the depth drops.        *
+ *********************************************/
+void subtreeDepthRemove (int64_t dirNb, int32_t depth) {
+	for (int64_t n = dirNb; n != -1; ) {
+		Inode_t *dir = getInode (n);
+		if (depth < dir->subDepth) {
+			return;			// a deeper entry is left
+		}
+		int64_t up = parentOf (n);
+		int32_t was = dir->subDepth;
+		dir->subDepth = depthScan (n, up);
+		if (dir->subDepth == was) {
+			return;			// another entry as deep is left
+		}
+		csumUpdate (dir, sizeof (Inode_t));
+		depth = was + 1;
+		n = up;
+	}
+}//subtreeDepthRemove
+
+/**********************************************
+ * Display the aggregates of directory path   *
+ * (current directory if NULL) and of each    *
+ * directory directly in it.                  *
+ *********************************************/
+void du (char *path) {
+	char full[PATH_MAXLEN + 1];
+	DirCursor_t cursor;
+	Dirent_t ents[READDIR_BATCH];
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+
+	if (path == NULL) {
+		strcpy (full, currDir);
+	} else if (path[0] == '/') {
+		snprintf (full, sizeof (full), "%s", path);
+	} else {
+		snprintf (full, sizeof (full), "%s%s%s", currDir, strcmp (currDir, "/") == 0 ? "" : "/", path);
+	}
+	int64_t dirNb = pathLookup (full, FT_DIR);
+	if (dirNb == -5) {
+		return;
+	}
+	if (dirNb == -1) {
+		printf ("%s no such directory\n", full);
+		return;
+	}
+
+	printf ("%10s %10s %12s %6s  %s\n", "entries", "blocks", "bytes", "depth", "directory");
+	cursor.iNodeNb = dirNb;
+	cursor.ptrIdx = 0;
+	cursor.offset = 0;
+	int32_t cnt;
+	while ((cnt = vsfs_readDir (&cursor, ents, READDIR_BATCH)) > 0) {
+		for (int32_t i=0; i<cnt; i++) {
+			if (ents[i].type != FT_DIR || ents[i].iNodeNb == dirNb
+			|| ents[i].iNodeNb == parentOf (dirNb)) {
+				continue;
+			}
+			Inode_t *d = getInode (ents[i].iNodeNb);
+			printf ("%10lld %10lld %12lld %6d  %s\n", (long long)d->subEntries, (long long)d->subBlocks,
+				(long long)d->subBlocks * sb->blockSize, d->subDepth, ents[i].fileName);
+		}
+	}
+	Inode_t *d = getInode (dirNb);
+	printf ("%10lld %10lld %12lld %6d  %s (total)\n", (long long)d->subEntries, (long long)d->subBlocks,
+		(long long)d->subBlocks * sb->blockSize, d->subDepth, full);
+}//du
+
+// Print the entries below directory dirNb (at path) whose name matches
+// pattern and type is ft (0 <=> any). Return number of matches.
+// Each entry accounts for itself and, if a directory, for its subEntries:
+// once the subEntries of dirNb are all accounted for, the rest of its
+// blocks hold only free slots and are not read.
+static int64_t findIn (int64_t dirNb, char *path, const char *pattern, int8_t ft, int64_t *visited) {
+	DirCursor_t cursor;
+	Dirent_t ents[READDIR_BATCH];
+	size_t len = strlen (path);
+	int64_t found = 0;
+	int64_t up = parentOf (dirNb);
+	int64_t left = getInode (dirNb)->subEntries;
+
+	(*visited)++;
+	cursor.iNodeNb = dirNb;
+	cursor.ptrIdx = 0;
+	cursor.offset = 0;
+	int32_t cnt;
+	while (left > 0 && (cnt = vsfs_readDir (&cursor, ents, READDIR_BATCH)) > 0) {
+		for (int32_t i=0; i<cnt && left > 0; i++) {
+			if (ents[i].iNodeNb == dirNb || ents[i].iNodeNb == up
+			|| strcmp (ents[i].fileName, "/") == 0) {
+				continue;
+			}
+			left--;
+			if (len + 1 + strlen (ents[i].fileName) > PATH_MAXLEN) {
+				continue;
+			}
+			snprintf (path + len, PATH_MAXLEN + 1 - len, "%s%s", (len == 1) ? "" : "/", ents[i].fileName);
+			if ((ft == 0 || ents[i].type == ft) && fnmatch (pattern, ents[i].fileName, 0) == 0) {
+				printf ("%s%s\n", path, (ents[i].type == FT_DIR) ? "/" : "");
+				found++;
+			}
+			if (ents[i].type == FT_DIR) {
+				Inode_t *d = getInode (ents[i].iNodeNb);
+				left -= d->subEntries;
+				// Nothing below an empty directory
+				if (d->subEntries != 0) {
+					found += findIn (ents[i].iNodeNb, path, pattern, ft, visited);
+				}
+			}
+			path[len] = 0;
+		}
+	}
+	return found;
+}
+
+/**********************************************
+ * Print the files below the current          *
+ * directory whose name matches the shell     *
+ * pattern, optionally of type ft (FT_FIL or  *
+ * FT_DIR, 0 <=> any). Empty subtrees are not *
+ * read, nor the blocks of a directory past   *
+ * its last entry.                            *
+ *********************************************/
+void find (const char *pattern, int8_t ft) {
+	char path[PATH_MAXLEN + 1];
+	int64_t visited = 0;
+
+	int64_t dirNb = pathLookup (currDir, FT_DIR);
+	if (dirNb == -5) {
+		return;
+	}
+	assert (dirNb >= 0);
+	strcpy (path, currDir);
+	int64_t found = findIn (dirNb, path, pattern, ft, &visited);
+	printf ("%lld found, %lld directories read, %lld below\n", (long long)found, (long long)visited,
+		(long long)getInode (dirNb)->subEntries);
+}//find
@@ -0,0 +1,403 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "vsfs.h"
+#include "library.h"
+
+extern void *disk;
+
+/*****************************************************************
+ * Operation traces.                                             *
+ * While recording, every API call appends a record: operation,  *
+ * arguments, result, time since the previous call and latency.  *
+ * A trace starts with the geometry of the disk it was recorded  *
+ * on, so a replay formats the same fresh disk, runs the calls   *
+ * (as fast as possible or at the recorded pacing) and reports   *
+ * throughput, latency and results that differ from the record.  *
+ * vsfs_readDir records the cursor it started from and the entry *
+ * count asked for; vsfs_statfs records the free block count as  *
+ * its result.                                                   *
+ * Integers are stored in host byte order.                       *
+ ****************************************************************/
+#define TRACE_MAGIC			0x52545356		// "VSTR"
+#define TRACE_VERSION		2			// 2: 64-bit block count
+#define TRACE_NAMEMAX		255						// longest name/path kept in a record
+
+typedef struct __attribute__((packed)) TraceHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint8_t directCnt;
+	uint8_t flags;							// SB_COMPRESS
+	int32_t blockSize;
+	int64_t blockCnt;
+} TraceHeader_t;
+
+// Followed by nameLen bytes of name, then dataLen bytes of data (TR_WRITE and TR_READDIR only)
+typedef struct __attribute__((packed)) TraceRec {
+	uint8_t op;									// TR_xxx
+	int8_t ft;									// file type (TR_COMPRESS: on/off)
+	uint8_t nameLen;
+	uint8_t pad;
+	int32_t result;
+	uint32_t delta;							// us since the previous call started
+	uint32_t latency;						// ns
+	int32_t dataLen;						// bytes written, or requested by TR_READ
+} TraceRec_t;
+
+// Data of a TR_READDIR record
+typedef struct __attribute__((packed)) TraceDir {
+	int64_t iNodeNb;						// cursor before the call
+	int32_t ptrIdx;
+	int32_t offset;
+	int32_t cnt;								// entries asked for
+} TraceDir_t;
+
+static const char *opName[TR_OPCNT] = {
+	"", "create", "rmf", "rmd", "cd", "ls", "lookup", "write", "read", "compress",
+	"readdir", "statfs"
+};
+
+static FILE *traceFile = NULL;			// trace being recorded
+static char traceBuf[1 << 16];			// stdio buffer of traceFile
+static int64_t lastStart = 0;				// start of the previous recorded call (ns)
+static int64_t recCnt = 0;
+
+static char *loaded = NULL;					// trace loaded for replay
+static int64_t loadedLen = 0;
+static int64_t opCnt[TR_OPCNT];
+
+// Bytes of data following the name of record r
+static int64_t dataOf (const TraceRec_t *r) {
+	return (r->op == TR_WRITE || r->op == TR_READDIR) ? r->dataLen : 0;
+}
+
+static int64_t nowNs () {
+	struct timespec t;
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return (int64_t)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/**************************************************
+ * Start recording API calls to file path. The    *
+ * disk must be mounted (its geometry is saved).  *
+ * return 0 on success, -1 if path can't be open  *
+ *************************************************/
+int32_t traceStart (const char *path) {
+	assert (disk != NULL);
+	SuperBlock_t *sb = (SuperBlock_t *)disk;
+
+	traceStop ();
+	traceFile = fopen (path, "wb");
+	if (traceFile == NULL) {
+		printf ("trace: can't create %s\n", path);
+		return -1;
+	}
+	setvbuf (traceFile, traceBuf, _IOFBF, sizeof (traceBuf));
+
+	TraceHeader_t h;
+	h.magic = TRACE_MAGIC;
+	h.version = TRACE_VERSION;
+	h.directCnt = (uint8_t)parameters.directCnt;
+	h.flags = (uint8_t)(sb->flags & SB_COMPRESS);
+	h.blockSize = sb->blockSize;
+	h.blockCnt = sb->blockCnt;
+	fwrite (&h, sizeof (h), 1, traceFile);
+
+	lastStart = nowNs ();
+	recCnt = 0;
+	return 0;
+}//traceStart
+
+/**************************************************
+ * Stop recording and close the trace file        *
+ *************************************************/
+void traceStop () {
+	if (traceFile == NULL) {
+		return;
+	}
+	fclose (traceFile);
+	traceFile = NULL;
+	printf ("trace: %lld calls recorded\n", (long long)recCnt);
+}//traceStop
+
+/**************************************************
+ * Start time of an API call, 0 when no trace is  *
+ * being recorded (the clock is not even read).   *
+ *************************************************/
+int64_t traceBegin () {
+	return (traceFile == NULL) ? 0 : nowNs ();
+}//traceBegin
+
+/**************************************************
+ * Append the record of an API call started at t0 *
+ * Parameters: operation (TR_xxx), name or path   *
+ *             (NULL if none), file type, data    *
+ *             written (NULL if none) and its     *
+ *             length, result of the call         *
+ *************************************************/
+void traceEnd (int8_t op, const char *name, int8_t ft, const char *data, int32_t len, int32_t result, int64_t t0) {
+	if (traceFile == NULL) {
+		return;
+	}
+	int64_t end = nowNs ();
+	size_t nameLen = (name == NULL) ? 0 : strlen (name);
+	if (nameLen > TRACE_NAMEMAX) {
+		nameLen = TRACE_NAMEMAX;
+	}
+	int64_t delta = (t0 - lastStart) / 1000;
+	int64_t latency = end - t0;
+
+	TraceRec_t r;
+	r.op = (uint8_t)op;
+	r.ft = ft;
+	r.nameLen = (uint8_t)nameLen;
+	r.pad = 0;
+	r.result = result;
+	r.delta = (delta > UINT32_MAX) ? UINT32_MAX : (uint32_t)delta;
+	r.latency = (latency > UINT32_MAX) ? UINT32_MAX : (uint32_t)latency;
+	r.dataLen = (len < 0) ? 0 : len;
+	fwrite (&r, sizeof (r), 1, traceFile);
+	if (nameLen != 0) {
+		fwrite (name, 1, nameLen, traceFile);
+	}
+	if (data != NULL && r.dataLen != 0) {
+		fwrite (data, 1, r.dataLen, traceFile);
+	}
+	lastStart = t0;
+	recCnt++;
+}//traceEnd
+
+/**************************************************
+ * Append the record of a vsfs_readDir call       *
+ * started at t0 from cursor at, asking for cnt   *
+ * entries and returning result                   *
+ *************************************************/
+void traceReadDir (const DirCursor_t *at, int32_t cnt, int32_t result, int64_t t0) {
+	if (traceFile == NULL) {
+		return;
+	}
+	TraceDir_t d;
+	d.iNodeNb = at->iNodeNb;
+	d.ptrIdx = at->ptrIdx;
+	d.offset = at->offset;
+	d.cnt = cnt;
+	traceEnd (TR_READDIR, NULL, 0, (const char *)&d, sizeof (d), result, t0);
+}//traceReadDir
+
+/**************************************************
+ * Read trace file path for traceReplay: check    *
+ * every record and set the parameters and disk   *
+ * size (*blockCnt) it was recorded with.         *
+ * return 0 on success, -1 if unreadable/invalid  *
+ *************************************************/
+int32_t traceLoad (const char *path, int64_t *blockCnt) {
+	FILE *f = fopen (path, "rb");
+	if (f == NULL) {
+		printf ("trace: can't open %s\n", path);
+		return -1;
+	}
+	fseek (f, 0, SEEK_END);
+	loadedLen = ftell (f);
+	fseek (f, 0, SEEK_SET);
+	free (loaded);
+	loaded = malloc (loadedLen > 0 ? loadedLen : 1);
+	assert (loaded != NULL);
+	int64_t got = (int64_t)fread (loaded, 1, loadedLen, f);
+	fclose (f);
+
+	TraceHeader_t h;
+	if (got != loadedLen || loadedLen < (int64_t)sizeof (h)) {
+		printf ("trace: %s is truncated\n", path);
+		return -1;
+	}
+	memcpy (&h, loaded, sizeof (h));
+	if (h.magic != TRACE_MAGIC || h.version != TRACE_VERSION) {
+		printf ("trace: %s is not a version %d trace\n", path, TRACE_VERSION);
+		return -1;
+	}
+	if (h.directCnt != DIRECTCNT) {
+		printf ("trace: recorded with %d direct pointers, this build has %d\n", h.directCnt, DIRECTCNT);
+		return -1;
+	}
+
+	memset (opCnt, 0, sizeof (opCnt));
+	int64_t pos = sizeof (h);
+	while (pos < loadedLen) {
+		TraceRec_t r;
+		if (pos + (int64_t)sizeof (r) > loadedLen) {
+			printf ("trace: %s is truncated\n", path);
+			return -1;
+		}
+		memcpy (&r, loaded + pos, sizeof (r));
+		pos += sizeof (r) + r.nameLen + dataOf (&r);
+		if (r.op == 0 || r.op >= TR_OPCNT || r.dataLen < 0 || pos > loadedLen
+		|| (r.op == TR_READDIR && r.dataLen != (int32_t)sizeof (TraceDir_t))) {
+			printf ("trace: %s has a bad record\n", path);
+			return -1;
+		}
+		opCnt[r.op]++;
+	}
+
+	parameters.blockSize = h.blockSize;
+	parameters.directCnt = h.directCnt;
+	parameters.compress = (h.flags & SB_COMPRESS) ? TRUE : FALSE;
+	*blockCnt = h.blockCnt;
+	return 0;
+}//traceLoad
+
+static int cmpLatency (const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+/**************************************************
+ * Run the loaded trace on the mounted (fresh)    *
+ * disk, at full speed or, if paced, keeping the  *
+ * recorded time between calls. Shell output is   *
+ * sent to /dev/null while running.               *
+ *************************************************/
+void traceReplay (int8_t paced) {
+	assert (loaded != NULL);
+	char name[TRACE_NAMEMAX + 1];
+	uint32_t *lat[TR_OPCNT];
+	int64_t done[TR_OPCNT];
+	int64_t differ[TR_OPCNT];
+	double recSum[TR_OPCNT];
+	int64_t total = 0;
+
+	// Largest read and readdir requests size the buffers
+	int32_t readMax = 1;
+	int32_t entMax = 1;
+	for (int64_t pos = sizeof (TraceHeader_t); pos < loadedLen; ) {
+		TraceRec_t r;
+		memcpy (&r, loaded + pos, sizeof (r));
+		if (r.op == TR_READ && r.dataLen > readMax) {
+			readMax = r.dataLen;
+		}
+		if (r.op == TR_READDIR) {
+			TraceDir_t d;
+			memcpy (&d, loaded + pos + sizeof (r) + r.nameLen, sizeof (d));
+			if (d.cnt > entMax) {
+				entMax = d.cnt;
+			}
+		}
+		pos += sizeof (r) + r.nameLen + dataOf (&r);
+	}
+	char *readBuf = malloc (readMax);
+	assert (readBuf != NULL);
+	Dirent_t *ents = malloc (entMax * sizeof (Dirent_t));
+	assert (ents != NULL);
+	for (int op=0; op<TR_OPCNT; op++) {
+		lat[op] = malloc ((opCnt[op] + 1) * sizeof (uint32_t));
+		assert (lat[op] != NULL);
+		done[op] = differ[op] = 0;
+		recSum[op] = 0;
+		total += opCnt[op];
+	}
+
+	int devNull = open ("/dev/null", O_WRONLY);
+	assert (devNull != -1);
+	fflush (stdout);
+	int savedOut = dup (STDOUT_FILENO);
+	assert (savedOut != -1);
+	dup2 (devNull, STDOUT_FILENO);
+
+	int64_t start = nowNs ();
+	int64_t due = start;					// recorded start of the current call
+	for (int64_t pos = sizeof (TraceHeader_t); pos < loadedLen; ) {
+		TraceRec_t r;
+		memcpy (&r, loaded + pos, sizeof (r));
+		pos += sizeof (r);
+		memcpy (name, loaded + pos, r.nameLen);
+		name[r.nameLen] = 0;
+		pos += r.nameLen;
+		char *data = loaded + pos;
+		pos += dataOf (&r);
+
+		due += (int64_t)r.delta * 1000;
+		if (paced && due > nowNs ()) {
+			struct timespec t = {due / 1000000000LL, due % 1000000000LL};
+			clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+		}
+
+		DirCursor_t cursor;
+		TraceDir_t d;
+		StatFs_t st;
+		int32_t result = 0;
+		int64_t t0 = nowNs ();
+		switch (r.op) {
+			case TR_CREATE:		result = vsfs_create (name, r.ft);								break;
+			case TR_RMF:			result = vsfs_RMF (name);													break;
+			case TR_RMD:			result = vsfs_RMD (name);													break;
+			case TR_CD:				vsfs_CD (name);																		break;
+			case TR_LS:				vsfs_LS ();																				break;
+			case TR_LOOKUP:		result = vsfs_openDir (name, &cursor);						break;
+			case TR_WRITE:		result = vsfs_write (name, data, r.dataLen);			break;
+			case TR_READ:			result = vsfs_read (name, readBuf, r.dataLen);		break;
+			case TR_COMPRESS:	result = vsfs_compress (name, r.ft);							break;
+			case TR_READDIR:
+				memcpy (&d, data, sizeof (d));
+				cursor.iNodeNb = d.iNodeNb;
+				cursor.ptrIdx = d.ptrIdx;
+				cursor.offset = d.offset;
+				result = vsfs_readDir (&cursor, ents, d.cnt);
+				break;
+			case TR_STATFS:
+				vsfs_statfs (&st);
+				result = (int32_t)st.freeBlocks;
+				break;
+		}
+		int64_t latency = nowNs () - t0;
+
+		lat[r.op][done[r.op]++] = (latency > UINT32_MAX) ? UINT32_MAX : (uint32_t)latency;
+		recSum[r.op] += r.latency;
+		if (result != r.result) {
+			differ[r.op]++;
+		}
+	}
+	double secs = (nowNs () - start) / 1e9;
+
+	fflush (stdout);
+	dup2 (savedOut, STDOUT_FILENO);
+	close (savedOut);
+	close (devNull);
+
+	printf ("==== Replay: %lld calls, %s ====\n", (long long)total, paced ? "recorded pacing" : "full speed");
+	printf ("%-9s %9s %7s %10s %10s %10s %10s %10s\n",
+		"op", "calls", "differ", "mean us", "p50 us", "p99 us", "max us", "rec. mean");
+	int64_t differTotal = 0;
+	for (int op=1; op<TR_OPCNT; op++) {
+		int64_t n = done[op];
+		if (n == 0) {
+			continue;
+		}
+		qsort (lat[op], n, sizeof (uint32_t), cmpLatency);
+		double sum = 0;
+		for (int64_t i=0; i<n; i++) {
+			sum += lat[op][i];
+		}
+		printf ("%-9s %9lld %7lld %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+			opName[op], (long long)n, (long long)differ[op], sum / n / 1000,
+			lat[op][n / 2] / 1000.0, lat[op][(n * 99) / 100] / 1000.0, lat[op][n - 1] / 1000.0,
+			recSum[op] / n / 1000);
+		differTotal += differ[op];
+	}
+	printf ("%.3f s, %.0f calls/s, %lld results differ from the trace\n",
+		secs, total / secs, (long long)differTotal);
+	printf ("===============================\n");
+
+	for (int op=0; op<TR_OPCNT; op++) {
+		free (lat[op]);
+	}
+	free (readBuf);
+	free (ents);
+	free (loaded);
+	loaded = NULL;
+}//traceReplay
@@ -2,8 +2,12 @@
 #define VSFS_H
 
 #define MAGICNB				0x56534653
+#define VSFS_VERSION		2			// on-disk format: 64-bit block and iNode numbers
 #define FT_DIR 					1			// File is a directory
 #define FT_FIL					2			// File is a data file
+#define IN_COMPRESS			0x01	// iNode flag: compress the data of this file
+#define IN_ZDATA				0x02	// iNode flag: data blocks hold compressed data
+#define SB_COMPRESS			0x01	// Superblock flag: new files are compressed
 #define PATH_MAXLEN			255		// Path maximum length
 #define TRUE						1
 #define FALSE						0
@@ -12,13 +16,31 @@
 #define BLOCKSIZE				96		// bytes
 #define INODEBMSIZE			1			// Inode bit map size in block
 #define DATABMSIZE			1			// Data bit map size in block
-#define INODETABSIZE		10		// Inode table size in block
+#define INODECNT				48		// iNodes in the default iNode table
+#define INODE_RATIO			8			// blocks per iNode when the table grows with the disk
 #define DIRECTCNT				3			// number of pointers in an iNode
 #define FILENAME_LENGTH	16		// Max chars in a file name
+#define CSUM_MAXTHREADS	16		// Max threads verifying checksums
+#define READDIR_BATCH		16		// Entries fetched per vsfs_readDir call by ls
+#define LS_BUFSIZE			512		// ls output buffer (bytes)
+
+// Operations recorded in a trace (see trace.c)
+#define TR_CREATE				1
+#define TR_RMF					2
+#define TR_RMD					3
+#define TR_CD						4
+#define TR_LS						5
+#define TR_LOOKUP				6			// vsfs_openDir
+#define TR_WRITE				7
+#define TR_READ					8
+#define TR_COMPRESS			9
+#define TR_READDIR			10
+#define TR_STATFS				11
+#define TR_OPCNT				12
 
 // The following for shell simulation
 #define CMDE_LENGTH		64			// Max length of command
-#define CMDCNT				13			// Number of commands
+#define CMDCNT				23			// Number of commands
 #define BADCMDE 			-1
 #define HELP					0
 #define LS 						1
@@ -32,6 +54,16 @@
 #define DUMPINODE			9
 #define DUMPBLOCK			10
 #define DUMPBLOCKDIR	11
+#define DF						12
+#define WRITE					13
+#define CAT						14
+#define ZIP						15
+#define UNZIP					16
+#define DEDUP					17
+#define FSCK					18
+#define DU						19
+#define FIND					20
+#define IOSTAT				21
 #define QUIT					99
 
 // Colors used in printf (B for bold)
@@ -61,36 +93,75 @@ typedef struct Parameters {
 	int dataBMSize;				// Size (in blocks) of data block bit map
 	int iNodeTabSize;			// Size (in blocks) of iNode table
 	int directCnt;				// Number of direct pointers in an iNode
+	int compress;					// TRUE <=> new files are compressed
 } Parameters;
 
-	Parameters parameters;
-	int paramDebug;
+extern Parameters parameters;
+extern int paramDebug;
 
 // Superblock contains general information about the file system
 typedef struct SuperBlock {
 	int32_t signature;		// magic number
-	int32_t blockCnt;			// blocks on the disk
+	int32_t version;			// VSFS_VERSION
+	int64_t blockCnt;			// blocks on the disk
 	int32_t blockSize;		// in bytes
-	int32_t iNodeBMSize;	// in blocks	
-	int32_t dataBMSize;		// in blocks	
-	int32_t iNodeTabSize;	// in blocks	
 	int32_t iNodeSize;		// in bytes
+	int32_t flags;				// SB_COMPRESS
+	int64_t iNodeBMSize;	// in blocks
+	int64_t dataBMSize;		// in blocks
+	int64_t iNodeTabSize;	// in blocks
+	int64_t csumStart;		// first block of the checksum table
+	int64_t csumBlocks;		// in blocks
+	int64_t freeINodeCnt;	// free iNodes
+	int64_t freeDataCnt;	// free data blocks
 } SuperBlock_t;
 
 // iNode contains a limited data.
 typedef struct Inode {
 	int8_t type;						// file type
-	int32_t number;					// iNode number
-	int32_t ptr[DIRECTCNT];	// pointers to data block
+	int8_t flags;						// IN_COMPRESS, IN_ZDATA
+	int32_t subDepth;				// directory: longest path down to an entry (0 <=> empty)
+	int64_t number;					// iNode number
+	int64_t size;						// data file size in bytes
+	int64_t storedSize;			// bytes held in data blocks (compressed size if IN_ZDATA)
+	int64_t subEntries;			// directory: files and directories below it
+	int64_t subBlocks;			// directory: data blocks of its subtree, its own included
+	int64_t ptr[DIRECTCNT];	// pointers to data block
 }Inode_t;
 
 // Datablock for a directory is a chain of DirEntry.
 typedef struct DirEntry {
   struct DirEntry *next;						// Pointer to next DirEntry. NULL at the end.
-  int32_t iNodeNb;									// -1 <=> entry available (corresponding file has been deleted)
+  int64_t iNodeNb;									// -1 <=> entry available (corresponding file has been deleted)
   char fileName[FILENAME_LENGTH];		// File name
 } DirEntry_t;
 
+// One entry of a directory as returned by vsfs_readDir.
+typedef struct Dirent {
+	int64_t iNodeNb;										// iNode number of the file
+	int8_t type;												// FT_DIR or FT_FIL
+	char fileName[FILENAME_LENGTH + 1];	// File name (always null terminated)
+} Dirent_t;
+
+// File system usage as returned by vsfs_statfs.
+typedef struct StatFs {
+	int32_t blockSize;		// in bytes
+	int64_t blocks;				// data blocks
+	int64_t usedBlocks;
+	int64_t freeBlocks;
+	int64_t pendingBlocks;	// freed, waiting to be cleared (counted as used)
+	int64_t iNodes;
+	int64_t usedINodes;
+	int64_t freeINodes;
+} StatFs_t;
+
+// Resumable position in a directory. Filled by vsfs_openDir.
+typedef struct DirCursor {
+	int64_t iNodeNb;			// iNode number of the directory being read
+	int32_t ptrIdx;				// index in ptr[] of the data block being read
+	int32_t offset;				// offset (bytes) of next entry in that block. -1 <=> end
+} DirCursor_t;
+
 // Reading parameters values
 void getParams (char *);				// get parameters from file
 void initParams ();							// assign default values
@@ -99,20 +170,47 @@ void initParams ();							// assign default values
 void dumpBM (int8_t *);					// dump bit map given its address 
 void dumpDataBM ();							// dump data bit map
 void dumpInodesBM ();						// dump iNodes bit map
-void dumpInode (int32_t);				// dump iNode (iNode number)
-void dumpDataDirBlock (int32_t);// dump data block viewed as dir (block number)
-void dumpDataBlock (int32_t);		// dump data block (pure data)
+void dumpInode (int64_t);				// dump iNode (iNode number)
+void dumpDataDirBlock (int64_t);// dump data block viewed as dir (block number)
+void dumpDataBlock (int64_t);		// dump data block (pure data)
 void dumpDisk ();								// dump super block
 
 //////////////////////////////////////////////
 // The following are API (visible to users) //
 //////////////////////////////////////////////
-void vsfs_initDisk (int32_t);					// disk initialization
+void vsfs_initDisk (int64_t);					// disk initialization
 void vsfs_mount ();										// mount disk
 void vsfs_LS ();											// list files in current directory
+int32_t vsfs_openDir (char *, DirCursor_t *);					// position cursor at the start of a directory
+int32_t vsfs_readDir (DirCursor_t *, Dirent_t *, int32_t);	// fill up to n entries, return count (0 at end)
 void vsfs_CD (char *);								// change directory
 int32_t vsfs_create (char *, int8_t);	// create a file of a given type in the current directory
 int32_t vsfs_RMD (char *);						// remove directory in current directory
 int32_t vsfs_RMF (char *);						// remove file in current directory
+int32_t vsfs_write (char *, char *, int32_t);	// replace content of a file in current directory
+int32_t vsfs_read (char *, char *, int32_t);	// read content of a file in current directory
+int32_t vsfs_compress (char *, int8_t);			// turn compression of a file on/off
+void vsfs_statfs (StatFs_t *);							// file system usage from the superblock counters
+
+// Shell
+int parseAndExecute (char *);					// run one command line, return 1 on quit
+void soak (int64_t);									// run n mixed commands and report memory usage
+void du (char *);											// subtree usage of a directory and its subdirectories
+void find (const char *, int8_t);			// print files matching a pattern below the current directory
+int32_t traceStart (const char *);		// record API calls to a trace file
+void traceStop ();										// close the trace file
+int32_t traceLoad (const char *, int64_t *);	// read a trace, set parameters and disk size
+void traceReplay (int8_t);							// replay the loaded trace (TRUE: recorded pacing)
+
+// Readers of a disk shared by another process (see shm.c)
+int32_t shmAttach (const char *);			// map the disk published under a name, read-only
+int64_t shmLookup (const char *, int8_t);	// iNode number of an absolute path of a given type
+int32_t shmStat (const char *, Inode_t *);	// copy the iNode of an absolute path
+int32_t shmReadDir (const char *, Dirent_t *, int32_t);	// fill up to n entries of a directory
+void shmReader (int64_t, int32_t);		// read-only shell, or bench with n ops in p processes
+
+// Simulated storage device in front of the disk (see device.c)
+int32_t devStart (const char *);			// model from a profile and key=value overrides
+void devReport ();										// display I/O counters and device time
 
 #endif
\ No newline at end of file